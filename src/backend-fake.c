@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2014 Raul Cesar Teixeira
+ *
+ * Author: Raul Cesar Teixeira
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <gio/gio.h>
+
+#include "backend.h"
+
+/* In-process stand-in for the LightDM daemon, for profiling the bridge and
+ * load testing themes on a box without one. Users are synthetic and every
+ * PAM prompt wants the user name as answer, as in the themes' mock.js.
+ * Latencies stand in for PAM modules and the daemon round trips. */
+
+#define FAKE_BACKEND_GROUP "fake-backend"
+
+struct _BackendUser
+{
+    gint ref_count;
+    gchar *name;
+    gchar *real_name;
+    gchar *session;
+    gboolean logged_in;
+};
+
+typedef struct
+{
+    guint n_users;
+    gchar *image;
+    gchar **prompts;
+    gchar *message;
+    guint prompt_latency;
+    guint auth_latency;
+    gchar **slow_auth_users;
+    guint slow_auth_latency;
+    guint session_latency;
+    guint session_length;
+    gchar **power;
+} FakeSettings;
+
+static FakeSettings settings =
+{
+    .n_users = 10,
+};
+
+static const BackendSession default_sessions[] =
+{
+    { "gnome", "GNOME", "This session logs you into GNOME" },
+    { "plasma", "Plasma", "Plasma by KDE" },
+    { "xfce", "Xfce Session", "Use this session to run Xfce as your desktop environment" },
+};
+/* Set before connect, the greeter reads them before it connects */
+static BackendSession *sessions = (BackendSession *) default_sessions;
+static guint n_sessions = G_N_ELEMENTS (default_sessions);
+
+static const BackendEvents *events = NULL;
+static GList *users = NULL;
+
+static gchar *authentication_user = NULL;
+static gboolean in_authentication = FALSE, is_authenticated = FALSE, answers_ok = FALSE;
+static guint prompt_index = 0;
+static guint pending_id = 0;
+static gboolean resettable = FALSE;
+
+void
+fake_backend_set_n_users (guint count)
+{
+    settings.n_users = count;
+}
+
+static gboolean
+strv_contains (gchar **strv, const gchar *str)
+{
+    for (; strv != NULL && *strv != NULL; strv++)
+        if (g_strcmp0 (*strv, str) == 0)
+            return TRUE;
+
+    return FALSE;
+}
+
+static guint
+get_latency (GKeyFile *keyfile, const gchar *key)
+{
+    return MAX (g_key_file_get_integer (keyfile, FAKE_BACKEND_GROUP, key, NULL), 0);
+}
+
+void
+fake_backend_load_settings (GKeyFile *keyfile)
+{
+    gchar **keys;
+    guint i;
+
+    if (!g_key_file_has_group (keyfile, FAKE_BACKEND_GROUP))
+        return;
+
+    if (g_key_file_has_key (keyfile, FAKE_BACKEND_GROUP, "users", NULL))
+        settings.n_users = MAX (g_key_file_get_integer (keyfile, FAKE_BACKEND_GROUP, "users", NULL), 0);
+    settings.image = g_key_file_get_string (keyfile, FAKE_BACKEND_GROUP, "image", NULL);
+    settings.prompts = g_key_file_get_string_list (keyfile, FAKE_BACKEND_GROUP, "prompts", NULL, NULL);
+    settings.message = g_key_file_get_string (keyfile, FAKE_BACKEND_GROUP, "message", NULL);
+    settings.prompt_latency = get_latency (keyfile, "prompt-latency");
+    settings.auth_latency = get_latency (keyfile, "auth-latency");
+    settings.slow_auth_users = g_key_file_get_string_list (keyfile, FAKE_BACKEND_GROUP, "slow-auth-users", NULL, NULL);
+    settings.slow_auth_latency = get_latency (keyfile, "slow-auth-latency");
+    settings.session_latency = get_latency (keyfile, "session-latency");
+    settings.session_length = get_latency (keyfile, "session-length");
+    settings.power = g_key_file_get_string_list (keyfile, FAKE_BACKEND_GROUP, "power", NULL, NULL);
+
+    /* Session keys, each also used as the name */
+    keys = g_key_file_get_string_list (keyfile, FAKE_BACKEND_GROUP, "sessions", NULL, NULL);
+    if (keys != NULL && keys[0] != NULL)
+    {
+        n_sessions = g_strv_length (keys);
+        sessions = g_new0 (BackendSession, n_sessions);
+        for (i = 0; i < n_sessions; i++)
+        {
+            sessions[i].key = keys[i];
+            sessions[i].name = keys[i];
+            sessions[i].comment = "";
+        }
+        /* The strings now belong to sessions */
+        g_free (keys);
+    }
+    else
+        g_strfreev (keys);
+}
+
+static void
+create_users (void)
+{
+    guint i;
+
+    for (i = 1; i <= settings.n_users; i++)
+    {
+        BackendUser *user = g_new0 (BackendUser, 1);
+
+        user->ref_count = 1;
+        user->name = g_strdup_printf ("user%04u", i);
+        user->real_name = g_strdup_printf ("Test User %u", i);
+        user->session = g_strdup (sessions[i % n_sessions].key);
+        user->logged_in = i % 7 == 0;
+        users = g_list_prepend (users, user);
+    }
+    users = g_list_reverse (users);
+}
+
+static gboolean
+fake_backend_set_resettable (gboolean value)
+{
+    resettable = value;
+    return TRUE;
+}
+
+static gboolean
+fake_backend_connect (const BackendEvents *backend_events, GError **error)
+{
+    events = backend_events;
+    if (settings.prompts == NULL || settings.prompts[0] == NULL)
+    {
+        g_strfreev (settings.prompts);
+        settings.prompts = g_strsplit ("Password:", ";", -1);
+    }
+    create_users ();
+    g_message ("Fake backend with %u users and %u sessions", settings.n_users, n_sessions);
+
+    return TRUE;
+}
+
+static const GList *
+fake_backend_get_users (void)
+{
+    return users;
+}
+
+static BackendUser *
+fake_backend_user_ref (BackendUser *user)
+{
+    user->ref_count++;
+    return user;
+}
+
+static void
+fake_backend_user_unref (BackendUser *user)
+{
+    if (--user->ref_count > 0)
+        return;
+
+    g_free (user->name);
+    g_free (user->real_name);
+    g_free (user->session);
+    g_free (user);
+}
+
+static const gchar *
+fake_backend_user_get_name (BackendUser *user)
+{
+    return user->name;
+}
+
+static const gchar *
+fake_backend_user_get_real_name (BackendUser *user)
+{
+    return user->real_name;
+}
+
+static const gchar *
+fake_backend_user_get_image (BackendUser *user)
+{
+    return settings.image;
+}
+
+static const gchar *
+fake_backend_user_get_null (BackendUser *user)
+{
+    return NULL;
+}
+
+static const gchar *
+fake_backend_user_get_session (BackendUser *user)
+{
+    return user->session;
+}
+
+static gboolean
+fake_backend_user_get_logged_in (BackendUser *user)
+{
+    return user->logged_in;
+}
+
+static const gchar *
+fake_backend_get_hostname (void)
+{
+    return "fake-host";
+}
+
+static const gchar *
+fake_backend_get_default_session_hint (void)
+{
+    return sessions[0].key;
+}
+
+static const gchar *
+fake_backend_get_null (void)
+{
+    return NULL;
+}
+
+static gint
+fake_backend_get_autologin_timeout_hint (void)
+{
+    return 0;
+}
+
+/* Like the daemon, answers come back from the main loop and never from
+ * inside the call that asked, a latency of 0 is the next idle */
+static void
+schedule (guint latency, GSourceFunc callback)
+{
+    if (pending_id != 0)
+        g_source_remove (pending_id);
+
+    if (latency > 0)
+        pending_id = g_timeout_add (latency, callback, NULL);
+    else
+        pending_id = g_idle_add (callback, NULL);
+}
+
+static gboolean
+prompt_cb (gpointer data)
+{
+    pending_id = 0;
+    if (prompt_index == 0 && settings.message != NULL)
+        events->show_message (settings.message, FALSE);
+    /* The first prompt is the password, later ones are shown as typed */
+    events->show_prompt (settings.prompts[prompt_index], prompt_index == 0);
+
+    return FALSE;
+}
+
+static gboolean
+complete_cb (gpointer data)
+{
+    pending_id = 0;
+    in_authentication = FALSE;
+    is_authenticated = answers_ok;
+    if (!is_authenticated)
+        events->show_message ("Authentication failure", TRUE);
+    events->authentication_complete ();
+
+    return FALSE;
+}
+
+static guint
+get_auth_latency (void)
+{
+    if (strv_contains (settings.slow_auth_users, authentication_user))
+        return settings.slow_auth_latency;
+
+    return settings.auth_latency;
+}
+
+static void
+fake_backend_authenticate (const gchar *username)
+{
+    g_free (authentication_user);
+    authentication_user = g_strdup (username);
+    in_authentication = TRUE;
+    is_authenticated = FALSE;
+    answers_ok = TRUE;
+    prompt_index = 0;
+    schedule (settings.prompt_latency, prompt_cb);
+}
+
+static void
+fake_backend_respond (const gchar *response)
+{
+    /* Only while a prompt is up */
+    if (!in_authentication || pending_id != 0)
+        return;
+
+    answers_ok = answers_ok && g_strcmp0 (response, authentication_user) == 0;
+    prompt_index++;
+    if (settings.prompts[prompt_index] != NULL)
+        schedule (settings.prompt_latency, prompt_cb);
+    else
+        schedule (get_auth_latency (), complete_cb);
+}
+
+static void
+fake_backend_cancel_authentication (void)
+{
+    if (pending_id != 0)
+        g_source_remove (pending_id);
+    pending_id = 0;
+    in_authentication = FALSE;
+    is_authenticated = FALSE;
+}
+
+static void
+fake_backend_cancel_autologin (void)
+{
+}
+
+static gboolean
+fake_backend_get_in_authentication (void)
+{
+    return in_authentication;
+}
+
+static gboolean
+fake_backend_get_is_authenticated (void)
+{
+    return is_authenticated;
+}
+
+static const gchar *
+fake_backend_get_authentication_user (void)
+{
+    return authentication_user;
+}
+
+static void
+fake_backend_set_language (const gchar *language)
+{
+}
+
+/* A kept greeter goes idle while the session runs, and is reset with the
+ * authentication forgotten once the session ends */
+static gboolean
+idle_cb (gpointer data)
+{
+    events->idle ();
+
+    return FALSE;
+}
+
+static gboolean
+reset_cb (gpointer data)
+{
+    fake_backend_cancel_authentication ();
+    g_free (authentication_user);
+    authentication_user = NULL;
+    events->reset ();
+
+    return FALSE;
+}
+
+static gboolean
+fake_backend_start_session (const gchar *session, GError **error)
+{
+    if (!is_authenticated)
+    {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, "Not authenticated");
+        return FALSE;
+    }
+
+    /* Blocks the caller as lightdm_greeter_start_session_sync does */
+    if (settings.session_latency > 0)
+        g_usleep (settings.session_latency * G_TIME_SPAN_MILLISECOND);
+
+    g_message ("Fake backend starting session %s for %s", session ? session : "(default)", authentication_user);
+    if (resettable)
+    {
+        g_idle_add (idle_cb, NULL);
+        if (settings.session_length > 0)
+            g_timeout_add (settings.session_length, reset_cb, NULL);
+    }
+    return TRUE;
+}
+
+static const BackendSession *
+fake_backend_get_sessions (guint *count)
+{
+    *count = n_sessions;
+    return sessions;
+}
+
+static gboolean
+can_power (const gchar *action)
+{
+    return strv_contains (settings.power, action);
+}
+
+static gboolean
+fake_backend_get_can_suspend (void)
+{
+    return can_power ("suspend");
+}
+
+static gboolean
+fake_backend_get_can_hibernate (void)
+{
+    return can_power ("hibernate");
+}
+
+static gboolean
+fake_backend_get_can_restart (void)
+{
+    return can_power ("restart");
+}
+
+static gboolean
+fake_backend_get_can_shutdown (void)
+{
+    return can_power ("shutdown");
+}
+
+static gboolean
+power_action (const gchar *action, GError **error)
+{
+    if (!can_power (action))
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Cannot %s", action);
+        return FALSE;
+    }
+
+    g_message ("Fake backend would %s now", action);
+    return TRUE;
+}
+
+static gboolean
+fake_backend_suspend (GError **error)
+{
+    return power_action ("suspend", error);
+}
+
+static gboolean
+fake_backend_hibernate (GError **error)
+{
+    return power_action ("hibernate", error);
+}
+
+static gboolean
+fake_backend_restart (GError **error)
+{
+    return power_action ("restart", error);
+}
+
+static gboolean
+fake_backend_shutdown (GError **error)
+{
+    return power_action ("shutdown", error);
+}
+
+const Backend fake_backend =
+{
+    .name = "fake",
+    .set_resettable = fake_backend_set_resettable,
+    .connect = fake_backend_connect,
+    .get_users = fake_backend_get_users,
+    .user_ref = fake_backend_user_ref,
+    .user_unref = fake_backend_user_unref,
+    .user_get_name = fake_backend_user_get_name,
+    .user_get_real_name = fake_backend_user_get_real_name,
+    .user_get_display_name = fake_backend_user_get_real_name,
+    .user_get_image = fake_backend_user_get_image,
+    .user_get_language = fake_backend_user_get_null,
+    .user_get_layout = fake_backend_user_get_null,
+    .user_get_session = fake_backend_user_get_session,
+    .user_get_logged_in = fake_backend_user_get_logged_in,
+    .get_hostname = fake_backend_get_hostname,
+    .get_default_session_hint = fake_backend_get_default_session_hint,
+    .get_autologin_user_hint = fake_backend_get_null,
+    .get_autologin_timeout_hint = fake_backend_get_autologin_timeout_hint,
+    .get_select_user_hint = fake_backend_get_null,
+    .authenticate = fake_backend_authenticate,
+    .respond = fake_backend_respond,
+    .cancel_authentication = fake_backend_cancel_authentication,
+    .cancel_autologin = fake_backend_cancel_autologin,
+    .get_in_authentication = fake_backend_get_in_authentication,
+    .get_is_authenticated = fake_backend_get_is_authenticated,
+    .get_authentication_user = fake_backend_get_authentication_user,
+    .set_language = fake_backend_set_language,
+    .start_session = fake_backend_start_session,
+    .get_sessions = fake_backend_get_sessions,
+    .get_can_suspend = fake_backend_get_can_suspend,
+    .get_can_hibernate = fake_backend_get_can_hibernate,
+    .get_can_restart = fake_backend_get_can_restart,
+    .get_can_shutdown = fake_backend_get_can_shutdown,
+    .suspend = fake_backend_suspend,
+    .hibernate = fake_backend_hibernate,
+    .restart = fake_backend_restart,
+    .shutdown = fake_backend_shutdown,
+};
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2014 Raul Cesar Teixeira
+ *
+ * Author: Raul Cesar Teixeira
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <lightdm.h>
+
+#include <../config.h>
+
+#include "backend.h"
+
+/* The real thing, liblightdm talking to the daemon that spawned us */
+
+static LightDMGreeter *greeter = NULL;
+static const BackendEvents *events = NULL;
+#ifdef HAVE_LIGHTDM_GREETER_SET_RESETTABLE
+static gboolean resettable = FALSE;
+#endif
+
+static void
+show_prompt_cb (LightDMGreeter *greeter, const gchar *text, LightDMPromptType type, gpointer data)
+{
+    events->show_prompt (text, type == LIGHTDM_PROMPT_TYPE_SECRET);
+}
+
+static void
+show_message_cb (LightDMGreeter *greeter, const gchar *text, LightDMMessageType type, gpointer data)
+{
+    events->show_message (text, type == LIGHTDM_MESSAGE_TYPE_ERROR);
+}
+
+static void
+authentication_complete_cb (LightDMGreeter *greeter, gpointer data)
+{
+    events->authentication_complete ();
+}
+
+static void
+autologin_timer_expired_cb (LightDMGreeter *greeter, gpointer data)
+{
+    events->autologin_timer_expired ();
+}
+
+static void
+user_added_cb (LightDMUserList *user_list, LightDMUser *user, gpointer data)
+{
+    events->user_added ((BackendUser *) user);
+}
+
+static void
+user_changed_cb (LightDMUserList *user_list, LightDMUser *user, gpointer data)
+{
+    events->user_changed ((BackendUser *) user);
+}
+
+static void
+user_removed_cb (LightDMUserList *user_list, LightDMUser *user, gpointer data)
+{
+    events->user_removed ((BackendUser *) user);
+}
+
+#ifdef HAVE_LIGHTDM_GREETER_SET_RESETTABLE
+static void
+idle_cb (LightDMGreeter *greeter, gpointer data)
+{
+    events->idle ();
+}
+
+static void
+reset_cb (LightDMGreeter *greeter, gpointer data)
+{
+    events->reset ();
+}
+#endif
+
+static gboolean
+lightdm_backend_set_resettable (gboolean value)
+{
+#ifdef HAVE_LIGHTDM_GREETER_SET_RESETTABLE
+    resettable = value;
+    return TRUE;
+#else
+    return !value;
+#endif
+}
+
+static gboolean
+lightdm_backend_connect (const BackendEvents *backend_events, GError **error)
+{
+    LightDMUserList *user_list;
+
+    events = backend_events;
+    greeter = lightdm_greeter_new ();
+    g_signal_connect (G_OBJECT (greeter), "show-prompt", G_CALLBACK (show_prompt_cb), NULL);
+    g_signal_connect (G_OBJECT (greeter), "show-message", G_CALLBACK (show_message_cb), NULL);
+    g_signal_connect (G_OBJECT (greeter), "authentication-complete", G_CALLBACK (authentication_complete_cb), NULL);
+    g_signal_connect (G_OBJECT (greeter), "autologin-timer-expired", G_CALLBACK (autologin_timer_expired_cb), NULL);
+#ifdef HAVE_LIGHTDM_GREETER_SET_RESETTABLE
+    lightdm_greeter_set_resettable (greeter, resettable);
+    g_signal_connect (G_OBJECT (greeter), "idle", G_CALLBACK (idle_cb), NULL);
+    g_signal_connect (G_OBJECT (greeter), "reset", G_CALLBACK (reset_cb), NULL);
+#endif
+
+    user_list = lightdm_user_list_get_instance ();
+    g_signal_connect (G_OBJECT (user_list), "user-added", G_CALLBACK (user_added_cb), NULL);
+    g_signal_connect (G_OBJECT (user_list), "user-changed", G_CALLBACK (user_changed_cb), NULL);
+    g_signal_connect (G_OBJECT (user_list), "user-removed", G_CALLBACK (user_removed_cb), NULL);
+
+    return lightdm_greeter_connect_sync (greeter, error);
+}
+
+static const GList *
+lightdm_backend_get_users (void)
+{
+    return lightdm_user_list_get_users (lightdm_user_list_get_instance ());
+}
+
+static BackendUser *
+lightdm_backend_user_ref (BackendUser *user)
+{
+    return g_object_ref (user);
+}
+
+static void
+lightdm_backend_user_unref (BackendUser *user)
+{
+    g_object_unref (user);
+}
+
+static const gchar *
+lightdm_backend_user_get_name (BackendUser *user)
+{
+    return lightdm_user_get_name ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_real_name (BackendUser *user)
+{
+    return lightdm_user_get_real_name ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_display_name (BackendUser *user)
+{
+    return lightdm_user_get_display_name ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_image (BackendUser *user)
+{
+    return lightdm_user_get_image ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_language (BackendUser *user)
+{
+    return lightdm_user_get_language ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_layout (BackendUser *user)
+{
+    return lightdm_user_get_layout ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_user_get_session (BackendUser *user)
+{
+    return lightdm_user_get_session ((LightDMUser *) user);
+}
+
+static gboolean
+lightdm_backend_user_get_logged_in (BackendUser *user)
+{
+    return lightdm_user_get_logged_in ((LightDMUser *) user);
+}
+
+static const gchar *
+lightdm_backend_get_default_session_hint (void)
+{
+    return lightdm_greeter_get_default_session_hint (greeter);
+}
+
+static const gchar *
+lightdm_backend_get_autologin_user_hint (void)
+{
+    return lightdm_greeter_get_autologin_user_hint (greeter);
+}
+
+static gint
+lightdm_backend_get_autologin_timeout_hint (void)
+{
+    return lightdm_greeter_get_autologin_timeout_hint (greeter);
+}
+
+static const gchar *
+lightdm_backend_get_select_user_hint (void)
+{
+#ifdef HAVE_LIGHTDM_GREETER_GET_SELECT_USER_HINT
+    return lightdm_greeter_get_select_user_hint (greeter);
+#else
+    return NULL;
+#endif
+}
+
+static void
+lightdm_backend_authenticate (const gchar *username)
+{
+    lightdm_greeter_authenticate (greeter, username);
+}
+
+static void
+lightdm_backend_respond (const gchar *response)
+{
+    lightdm_greeter_respond (greeter, response);
+}
+
+static void
+lightdm_backend_cancel_authentication (void)
+{
+    lightdm_greeter_cancel_authentication (greeter);
+}
+
+static void
+lightdm_backend_cancel_autologin (void)
+{
+    lightdm_greeter_cancel_autologin (greeter);
+}
+
+static gboolean
+lightdm_backend_get_in_authentication (void)
+{
+    return lightdm_greeter_get_in_authentication (greeter);
+}
+
+static gboolean
+lightdm_backend_get_is_authenticated (void)
+{
+    return lightdm_greeter_get_is_authenticated (greeter);
+}
+
+static const gchar *
+lightdm_backend_get_authentication_user (void)
+{
+    return lightdm_greeter_get_authentication_user (greeter);
+}
+
+static void
+lightdm_backend_set_language (const gchar *language)
+{
+#ifdef HAVE_LIGHTDM_GREETER_SET_LANGUAGE
+    lightdm_greeter_set_language (greeter, language);
+#endif
+}
+
+static gboolean
+lightdm_backend_start_session (const gchar *session, GError **error)
+{
+    return lightdm_greeter_start_session_sync (greeter, session, error);
+}
+
+const Backend lightdm_backend =
+{
+    .name = "lightdm",
+    .set_resettable = lightdm_backend_set_resettable,
+    .connect = lightdm_backend_connect,
+    .get_users = lightdm_backend_get_users,
+    .user_ref = lightdm_backend_user_ref,
+    .user_unref = lightdm_backend_user_unref,
+    .user_get_name = lightdm_backend_user_get_name,
+    .user_get_real_name = lightdm_backend_user_get_real_name,
+    .user_get_display_name = lightdm_backend_user_get_display_name,
+    .user_get_image = lightdm_backend_user_get_image,
+    .user_get_language = lightdm_backend_user_get_language,
+    .user_get_layout = lightdm_backend_user_get_layout,
+    .user_get_session = lightdm_backend_user_get_session,
+    .user_get_logged_in = lightdm_backend_user_get_logged_in,
+    .get_hostname = lightdm_get_hostname,
+    .get_default_session_hint = lightdm_backend_get_default_session_hint,
+    .get_autologin_user_hint = lightdm_backend_get_autologin_user_hint,
+    .get_autologin_timeout_hint = lightdm_backend_get_autologin_timeout_hint,
+    .get_select_user_hint = lightdm_backend_get_select_user_hint,
+    .authenticate = lightdm_backend_authenticate,
+    .respond = lightdm_backend_respond,
+    .cancel_authentication = lightdm_backend_cancel_authentication,
+    .cancel_autologin = lightdm_backend_cancel_autologin,
+    .get_in_authentication = lightdm_backend_get_in_authentication,
+    .get_is_authenticated = lightdm_backend_get_is_authenticated,
+    .get_authentication_user = lightdm_backend_get_authentication_user,
+    .set_language = lightdm_backend_set_language,
+    .start_session = lightdm_backend_start_session,
+    .get_sessions = NULL,
+    .get_can_suspend = lightdm_get_can_suspend,
+    .get_can_hibernate = lightdm_get_can_hibernate,
+    .get_can_restart = lightdm_get_can_restart,
+    .get_can_shutdown = lightdm_get_can_shutdown,
+    .suspend = lightdm_suspend,
+    .hibernate = lightdm_hibernate,
+    .restart = lightdm_restart,
+    .shutdown = lightdm_shutdown,
+};
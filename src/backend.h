@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2014 Raul Cesar Teixeira
+ *
+ * Author: Raul Cesar Teixeira
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <glib.h>
+
+/* Everything the greeter asks of the display manager. The real backend talks
+ * to the LightDM daemon through liblightdm, the stand-in lets the JS bridge
+ * and the themes run on a box without one. */
+
+/* Owned by the backend, a JS wrapper holds a reference */
+typedef struct _BackendUser BackendUser;
+
+typedef struct
+{
+    const gchar *key;
+    const gchar *name;
+    const gchar *comment;
+} BackendSession;
+
+/* What the backend reports back, always on the main loop */
+typedef struct
+{
+    void (*show_prompt) (const gchar *text, gboolean secret);
+    void (*show_message) (const gchar *text, gboolean error);
+    void (*authentication_complete) (void);
+    void (*autologin_timer_expired) (void);
+    void (*user_added) (BackendUser *user);
+    void (*user_changed) (BackendUser *user);
+    void (*user_removed) (BackendUser *user);
+    /* Warm standby only: a session took over, and the session ended */
+    void (*idle) (void);
+    void (*reset) (void);
+} BackendEvents;
+
+typedef struct
+{
+    const gchar *name;
+
+    /* Before connect: keep the greeter between logins instead of the
+     * daemon starting a new one, FALSE when the backend cannot */
+    gboolean (*set_resettable) (gboolean resettable);
+    gboolean (*connect) (const BackendEvents *events, GError **error);
+
+    const GList *(*get_users) (void);
+    BackendUser *(*user_ref) (BackendUser *user);
+    void (*user_unref) (BackendUser *user);
+    const gchar *(*user_get_name) (BackendUser *user);
+    const gchar *(*user_get_real_name) (BackendUser *user);
+    const gchar *(*user_get_display_name) (BackendUser *user);
+    const gchar *(*user_get_image) (BackendUser *user);
+    const gchar *(*user_get_language) (BackendUser *user);
+    const gchar *(*user_get_layout) (BackendUser *user);
+    const gchar *(*user_get_session) (BackendUser *user);
+    gboolean (*user_get_logged_in) (BackendUser *user);
+
+    const gchar *(*get_hostname) (void);
+    const gchar *(*get_default_session_hint) (void);
+    const gchar *(*get_autologin_user_hint) (void);
+    gint (*get_autologin_timeout_hint) (void);
+    const gchar *(*get_select_user_hint) (void);
+
+    void (*authenticate) (const gchar *username);
+    void (*respond) (const gchar *response);
+    void (*cancel_authentication) (void);
+    void (*cancel_autologin) (void);
+    gboolean (*get_in_authentication) (void);
+    gboolean (*get_is_authenticated) (void);
+    const gchar *(*get_authentication_user) (void);
+    void (*set_language) (const gchar *language);
+    gboolean (*start_session) (const gchar *session, GError **error);
+
+    /* NULL when sessions come from the .desktop files the daemon reads */
+    const BackendSession *(*get_sessions) (guint *n_sessions);
+
+    gboolean (*get_can_suspend) (void);
+    gboolean (*get_can_hibernate) (void);
+    gboolean (*get_can_restart) (void);
+    gboolean (*get_can_shutdown) (void);
+    gboolean (*suspend) (GError **error);
+    gboolean (*hibernate) (GError **error);
+    gboolean (*restart) (GError **error);
+    gboolean (*shutdown) (GError **error);
+} Backend;
+
+extern const Backend lightdm_backend;
+extern const Backend fake_backend;
+
+/* Reads the [fake-backend] group, see data/lightdm-tex-greeter.conf */
+void fake_backend_load_settings (GKeyFile *keyfile);
+
+/* Synthetic users user0001 to userNNNN, the password is the user name */
+void fake_backend_set_n_users (guint n_users);
+
+#endif /* BACKEND_H_ */
@@ -13,1257 +13,5633 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <gtk/gtk.h>
 #include <webkit/webkit.h>
 #include <JavaScriptCore/JavaScript.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
+#include <gdk/gdkx.h>
+#include <libxklavier/xklavier.h>
 #include <lightdm.h>
 
 #include <../config.h>
 
+#include "backend.h"
+
+#ifdef HAVE_JSGETMEMORYUSAGESTATISTICS
+/* Exported by JavaScriptCore, declared only in its private headers */
+extern JSObjectRef JSGetMemoryUsageStatistics (JSContextRef context);
+#endif
+
 static JSClassRef gettext_class, lightdm_greeter_class, lightdm_user_class, lightdm_language_class, lightdm_layout_class, lightdm_session_class;
 
 static WebKitWebView *web_view;
+static const Backend *backend = &lightdm_backend;
 static GtkWidget *window;
 static gchar *theme;
+static gchar *theme_dir;
+
+/* Secondary monitors only get a window painting a static background, the
+ * interactive web view lives on the primary monitor. */
+static GList *background_windows = NULL;
+static GdkPixbuf *background_pixbuf = NULL;
+static gchar *background = NULL;
+
+/* Language picked in the greeter, NULL means the locale we were started in */
+static gchar *current_language = NULL;
+
+/* Layouts from the keyboard-layouts key are compiled into the XKB groups of a
+ * single keymap at start-up, switching between them is a group lock. */
+static XklEngine *xkl_engine = NULL;
+static GHashTable *layout_groups = NULL;
+static gchar *current_layout = NULL;
+
+/* JS values built once per page and handed out on every read */
+static JSObjectRef layouts_array = NULL;
+static JSObjectRef sessions_array = NULL;
+static JSObjectRef languages_array = NULL;
+
+/* Thin clients with little RAM trade WebKit caches for a smaller footprint */
+typedef enum
+{
+    MEMORY_PROFILE_DEFAULT,
+    MEMORY_PROFILE_LOW
+} MemoryProfile;
 
-static void
-show_prompt_cb (LightDMGreeter *greeter, const gchar *text, WebKitWebView *view)
+/* A MemoryProfile, read as an index into memory_profile_choices */
+static gint memory_profile = MEMORY_PROFILE_DEFAULT;
+static gint js_heap_limit = 0;
+
+#define LOW_MEMORY_JS_HEAP_LIMIT_MB 64
+
+/* --benchmark-theme: the theme is loaded offscreen against the stand-in
+ * backend, the first synthetic user logs in and timings go to stdout. */
+typedef struct
 {
-    gchar *command;
+    gint64 started;
+    gint64 first_paint;
+    gint64 loaded;
+    gint64 interactive;
+    gint64 auth_started;
+    gint64 prompted;
+    gint64 session_started;
+    gboolean timed_out;
+} Benchmark;
+
+static gchar *benchmark_theme = NULL;
+static gint benchmark_users = 100;
+static gint benchmark_timeout = 60;
+static gchar *backend_name = NULL;
+static gchar *compile_users_conf_file = NULL;
+static Benchmark benchmark;
+
+static void benchmark_loaded (void);
+static void benchmark_prompted (void);
+static void benchmark_finish (void);
+
+/* Image of the last rendered theme shown until WebKit has loaded the page */
+static GtkWidget *splash_image = NULL;
+static gchar *theme_hash = NULL;
+
+/* Delay between load-finished and grabbing the web view contents, gives the
+ * theme a chance to run its onload handlers before we snapshot it. */
+#define SNAPSHOT_DELAY_MS 1000
 
-    g_debug("Show prompt %s", text);
+static void logMessage(GLogLevelFlags level, const gchar* format, ... ) {
+  va_list args;
 
-    command = g_strdup_printf ("show_prompt('%s')", text);
-    webkit_web_view_execute_script (web_view, command);
-    g_free (command);
+  GDateTime *dateTime = g_date_time_new_now_local ();
+  gchar* strDateTime = g_date_time_format(dateTime, "%F %T");
+  g_date_time_unref(dateTime);
+
+  //Alter format string, including the date/time.
+  const gchar* newFormat = g_strdup_printf("%s-> %s", strDateTime, format);
+  g_free(strDateTime);
+
+  //Call g_logv with arguments sent.
+  va_start (args, format);
+  g_logv(G_LOG_DOMAIN, level, newFormat, args);
+  va_end (args);
 }
 
-static void
-show_message_cb (LightDMGreeter *greeter, const gchar *text, WebKitWebView *view)
+/* With stall-threshold set a watchdog thread reports the main loop going
+ * quiet for longer than that, and code known to block marks itself with
+ * watchdog_enter()/watchdog_leave() so the report can say what ran. A
+ * scope that overran logs its own duration once it returns. */
+typedef struct
 {
-    gchar *command;
+    const gchar *name;
+    gpointer previous;
+    gint64 started;
+} WatchdogScope;
 
-    command = g_strdup_printf ("show_message('%s')", text);
-    webkit_web_view_execute_script (view, command);
-    g_free (command);
-}
+static gint stall_threshold = 0;
+static volatile gint watchdog_ticks = 0;
+static gpointer watchdog_current = NULL;
 
 static void
-authentication_complete_cb (LightDMGreeter *greeter, WebKitWebView *view)
+watchdog_enter (WatchdogScope *scope, const gchar *name)
 {
-    webkit_web_view_execute_script (view, "authentication_complete()");
+    scope->name = name;
+    scope->previous = g_atomic_pointer_get (&watchdog_current);
+    scope->started = g_get_monotonic_time ();
+    g_atomic_pointer_set (&watchdog_current, (gpointer) name);
 }
 
 static void
-autologin_timeout_expired_cb (LightDMGreeter *greeter, WebKitWebView *view)
+watchdog_leave (WatchdogScope *scope)
 {
-    gchar *command = g_strdup_printf ("autologin_timeout_expired()");
-    webkit_web_view_execute_script (view, command);
-    g_free (command);
+    gint64 elapsed_ms;
+
+    g_atomic_pointer_set (&watchdog_current, scope->previous);
+    if (stall_threshold <= 0)
+        return;
+
+    elapsed_ms = (g_get_monotonic_time () - scope->started) / 1000;
+    if (elapsed_ms >= stall_threshold)
+        logMessage(G_LOG_LEVEL_WARNING, "%s blocked the main loop for %" G_GINT64_FORMAT " ms", scope->name, elapsed_ms);
 }
 
 static gboolean
-fade_timer_cb (gpointer data)
+watchdog_tick_cb (gpointer data)
+{
+    g_atomic_int_inc (&watchdog_ticks);
+
+    return TRUE;
+}
+
+/* Reports once per stall, while it is still going on. A stall that never
+ * ends is the one worth knowing about most. */
+static gpointer
+watchdog_thread (gpointer data)
 {
-    gdouble opacity;
+    gint seen = g_atomic_int_get (&watchdog_ticks), ticks;
+    gint64 progress = g_get_monotonic_time (), now;
+    gboolean reported = FALSE;
 
-    opacity = gtk_window_get_opacity (GTK_WINDOW (window));
-    opacity -= 0.1;
-    if (opacity <= 0)
+    for (;;)
     {
-        gtk_main_quit ();
-        return FALSE;
+        g_usleep (stall_threshold * G_TIME_SPAN_MILLISECOND / 4);
+
+        now = g_get_monotonic_time ();
+        ticks = g_atomic_int_get (&watchdog_ticks);
+        if (ticks != seen)
+        {
+            seen = ticks;
+            progress = now;
+            reported = FALSE;
+        }
+        else if (!reported && now - progress >= stall_threshold * G_TIME_SPAN_MILLISECOND)
+        {
+            const gchar *current = g_atomic_pointer_get (&watchdog_current);
+
+            logMessage(G_LOG_LEVEL_WARNING, "Main loop stalled for %" G_GINT64_FORMAT " ms so far, in %s",
+                       (now - progress) / 1000, current ? current : "unmarked code");
+            reported = TRUE;
+        }
     }
-    gtk_window_set_opacity (GTK_WINDOW (window), opacity);
 
-    return TRUE;
+    return NULL;
 }
 
 static void
-quit_cb (LightDMGreeter *greeter, const gchar *username)
+start_watchdog (void)
 {
-    /* Fade out the greeter */
-    g_timeout_add (40, (GSourceFunc) fade_timer_cb, NULL);
+    if (stall_threshold <= 0)
+        return;
+
+    /* Ahead of everything else queued, a busy but healthy loop must not look stuck */
+    g_timeout_add_full (G_PRIORITY_HIGH, MAX (stall_threshold / 4, 1), watchdog_tick_cb, NULL, NULL);
+    g_thread_unref (g_thread_new ("watchdog", watchdog_thread, NULL));
+    logMessage(G_LOG_LEVEL_MESSAGE, "Watching for main loop stalls over %d ms", stall_threshold);
 }
 
-static JSValueRef
-get_user_name_cb (JSContextRef context,
-                  JSObjectRef thisObject,
-                  JSStringRef propertyName,
-                  JSValueRef *exception)
+static gchar *
+toGChar(JSStringRef jsstr)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+  size_t size;
+  gchar *buf;
+  size = JSStringGetMaximumUTF8CStringSize(jsstr);
+  buf = g_malloc0(size);
+  JSStringGetUTF8CString(jsstr, buf, size);
 
-    string = JSStringCreateWithUTF8CString (lightdm_user_get_name (user));
-    return JSValueMakeString (context, string);
+
+  return buf;
 }
 
 static JSValueRef
-get_user_real_name_cb (JSContextRef context,
-                       JSObjectRef thisObject,
-                       JSStringRef propertyName,
-                       JSValueRef *exception)
+make_js_string (JSContextRef context, const gchar *value)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
     JSStringRef string;
+    JSValueRef result;
 
-    string = JSStringCreateWithUTF8CString (lightdm_user_get_real_name (user));
-    return JSValueMakeString (context, string);
+    if (value == NULL)
+        return JSValueMakeNull (context);
+
+    string = JSStringCreateWithUTF8CString (value);
+    result = JSValueMakeString (context, string);
+    JSStringRelease (string);
+
+    return result;
 }
 
-static JSValueRef
-get_user_display_name_cb (JSContextRef context,
-                          JSObjectRef thisObject,
-                          JSStringRef propertyName,
-                          JSValueRef *exception)
+static void
+set_js_property (JSContextRef context, JSObjectRef object, const gchar *name, JSValueRef value)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    JSStringRef property = JSStringCreateWithUTF8CString (name);
 
-    string = JSStringCreateWithUTF8CString (lightdm_user_get_display_name (user));
-    return JSValueMakeString (context, string);
+    JSObjectSetProperty (context, object, property, value, kJSPropertyAttributeReadOnly, NULL);
+    JSStringRelease (property);
 }
 
-static JSValueRef
-get_user_image_cb (JSContextRef context,
-                   JSObjectRef thisObject,
-                   JSStringRef propertyName,
-                   JSValueRef *exception)
+static gchar *
+get_cache_filename (const gchar *name)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
-
-    string = JSStringCreateWithUTF8CString (lightdm_user_get_image (user));
-    return JSValueMakeString (context, string);
+    return g_build_filename (g_get_user_cache_dir (), "lightdm-tex-greeter", name, NULL);
 }
 
-static JSValueRef
-get_user_language_cb (JSContextRef context,
-                      JSObjectRef thisObject,
-                      JSStringRef propertyName,
-                      JSValueRef *exception)
+/* Timing of one pass through the PAM conversation, monotonic microseconds.
+ * Only durations are kept, never what was typed. */
+typedef enum
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    const gchar *language = lightdm_user_get_language (user);
-    JSStringRef string;
+    AUTH_STEP_START_TO_PROMPT,
+    AUTH_STEP_PROMPT_TO_SECRET,
+    AUTH_STEP_SECRET_TO_COMPLETE,
+    AUTH_STEP_COMPLETE_TO_LOGIN,
+    AUTH_STEP_SESSION_START,
+    AUTH_STEP_COUNT
+} AuthStep;
+
+static const gchar *auth_step_names[AUTH_STEP_COUNT] =
+{
+    "start_to_prompt",
+    "prompt_to_secret",
+    "secret_to_complete",
+    "complete_to_login",
+    "session_start"
+};
 
-    if (!language)
-        return JSValueMakeNull (context);
+typedef struct
+{
+    gint64 started;
+    gint64 prompted;
+    gint64 responded;
+    gint64 completed;
+    gint64 login_requested;
+    gint64 session_started;
+    gint n_prompts;
+} AuthTrace;
+
+/* Bucket 0 is under 1 ms, bucket i covers [2^(i-1), 2^i) ms, the last one is open ended */
+#define AUTH_HISTOGRAM_BUCKETS 18
+
+static AuthTrace auth_trace;
+static gint64 auth_last_durations[AUTH_STEP_COUNT];
+static guint auth_histograms[AUTH_STEP_COUNT][AUTH_HISTOGRAM_BUCKETS];
+static guint auth_attempts = 0, auth_failures = 0;
+
+static gint64
+auth_step_duration (AuthStep step)
+{
+    gint64 from = 0, to = 0;
 
-    string = JSStringCreateWithUTF8CString (language);
-    return JSValueMakeString (context, string);
+    switch (step)
+    {
+    case AUTH_STEP_START_TO_PROMPT:
+        from = auth_trace.started;
+        to = auth_trace.prompted;
+        break;
+    case AUTH_STEP_PROMPT_TO_SECRET:
+        from = auth_trace.prompted;
+        to = auth_trace.responded;
+        break;
+    case AUTH_STEP_SECRET_TO_COMPLETE:
+        from = auth_trace.responded;
+        to = auth_trace.completed;
+        break;
+    case AUTH_STEP_COMPLETE_TO_LOGIN:
+        from = auth_trace.completed;
+        to = auth_trace.login_requested;
+        break;
+    case AUTH_STEP_SESSION_START:
+        from = auth_trace.login_requested;
+        to = auth_trace.session_started;
+        break;
+    default:
+        break;
+    }
+
+    if (from == 0 || to == 0 || to < from)
+        return -1;
+    return to - from;
 }
 
-static JSValueRef
-get_user_layout_cb (JSContextRef context,
-                    JSObjectRef thisObject,
-                    JSStringRef propertyName,
-                    JSValueRef *exception)
+static guint
+auth_histogram_bucket (gint64 duration)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    const gchar *layout = lightdm_user_get_layout (user);
-    JSStringRef string;
+    gint64 ms = duration / 1000;
+    guint bucket = 0;
 
-    if (!layout)
-        return JSValueMakeNull (context);
+    while (ms > 0 && bucket < AUTH_HISTOGRAM_BUCKETS - 1)
+    {
+        ms >>= 1;
+        bucket++;
+    }
 
-    string = JSStringCreateWithUTF8CString (layout);
-    return JSValueMakeString (context, string);
+    return bucket;
 }
 
-static JSValueRef
-get_user_session_cb (JSContextRef context,
-                     JSObjectRef thisObject,
-                     JSStringRef propertyName,
-                     JSValueRef *exception)
+static void
+auth_stats_load (void)
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    const gchar *session = lightdm_user_get_session (user);
-    JSStringRef string;
-
-    if (!session)
-        return JSValueMakeNull (context);
+    GKeyFile *keyfile;
+    gchar *filename;
+    gint i, j;
 
-    string = JSStringCreateWithUTF8CString (session);
-    return JSValueMakeString (context, string);
+    filename = get_cache_filename ("auth-stats");
+    keyfile = g_key_file_new ();
+    if (g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, NULL))
+    {
+        auth_attempts = g_key_file_get_integer (keyfile, "totals", "attempts", NULL);
+        auth_failures = g_key_file_get_integer (keyfile, "totals", "failures", NULL);
+        for (i = 0; i < AUTH_STEP_COUNT; i++)
+        {
+            gsize length = 0;
+            gint *counts = g_key_file_get_integer_list (keyfile, "histograms", auth_step_names[i], &length, NULL);
+
+            for (j = 0; counts && j < length && j < AUTH_HISTOGRAM_BUCKETS; j++)
+                auth_histograms[i][j] = counts[j];
+            g_free (counts);
+        }
+    }
+    g_key_file_free (keyfile);
+    g_free (filename);
 }
 
-static JSValueRef
-get_user_logged_in_cb (JSContextRef context,
-                       JSObjectRef thisObject,
-                       JSStringRef propertyName,
-                       JSValueRef *exception)
+typedef struct
 {
-    LightDMUser *user = JSObjectGetPrivate (thisObject);
-    return JSValueMakeBoolean (context, lightdm_user_get_logged_in (user));
-}
+    gchar *filename;
+    gchar *data;
+    gsize length;
+} AuthStatsWrite;
 
-static JSValueRef
-get_language_code_cb (JSContextRef context,
-                      JSObjectRef thisObject,
-                      JSStringRef propertyName,
-                      JSValueRef *exception)
+static GThread *auth_stats_writer = NULL;
+
+static gpointer
+auth_stats_write_thread (gpointer data)
 {
-    LightDMLanguage *language = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    AuthStatsWrite *write = data;
+    GError *err = NULL;
+    gchar *dir;
 
-    string = JSStringCreateWithUTF8CString (lightdm_language_get_code (language));
-    return JSValueMakeString (context, string);
+    dir = g_path_get_dirname (write->filename);
+    g_mkdir_with_parents (dir, 0700);
+    if (!g_file_set_contents (write->filename, write->data, write->length, &err)) {
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error writing %s: %s", write->filename, err->message);
+      g_error_free (err);
+    }
+
+    g_free (dir);
+    g_free (write->filename);
+    g_free (write->data);
+    g_free (write);
+
+    return NULL;
 }
 
-static JSValueRef
-get_language_name_cb (JSContextRef context,
-                      JSObjectRef thisObject,
-                      JSStringRef propertyName,
-                      JSValueRef *exception)
+/* Waits for the last write, before the next one or before we exit */
+static void
+auth_stats_flush (void)
 {
-    LightDMLanguage *language = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    if (auth_stats_writer == NULL)
+        return;
 
-    string = JSStringCreateWithUTF8CString (lightdm_language_get_name (language));
-    return JSValueMakeString (context, string);
+    g_thread_join (auth_stats_writer);
+    auth_stats_writer = NULL;
 }
 
-static JSValueRef
-get_language_territory_cb (JSContextRef context,
-                           JSObjectRef thisObject,
-                           JSStringRef propertyName,
-                           JSValueRef *exception)
+/* Serialised here, written on a worker: the last save happens right after
+ * start_session, while the daemon waits for us to hand over the display */
+static void
+auth_stats_save (void)
 {
-    LightDMLanguage *language = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    GKeyFile *keyfile;
+    AuthStatsWrite *write;
+    gint counts[AUTH_HISTOGRAM_BUCKETS];
+    gint i, j;
 
-    string = JSStringCreateWithUTF8CString (lightdm_language_get_territory (language));
-    return JSValueMakeString (context, string);
+    /* A benchmark run must not skew the real greeter's numbers */
+    if (benchmark_theme != NULL)
+        return;
+
+    keyfile = g_key_file_new ();
+    g_key_file_set_integer (keyfile, "totals", "attempts", auth_attempts);
+    g_key_file_set_integer (keyfile, "totals", "failures", auth_failures);
+    for (i = 0; i < AUTH_STEP_COUNT; i++)
+    {
+        for (j = 0; j < AUTH_HISTOGRAM_BUCKETS; j++)
+            counts[j] = auth_histograms[i][j];
+        g_key_file_set_integer_list (keyfile, "histograms", auth_step_names[i], counts, AUTH_HISTOGRAM_BUCKETS);
+        if (auth_last_durations[i] >= 0)
+            g_key_file_set_int64 (keyfile, "last", auth_step_names[i], auth_last_durations[i] / 1000);
+    }
+
+    write = g_new0 (AuthStatsWrite, 1);
+    write->filename = get_cache_filename ("auth-stats");
+    write->data = g_key_file_to_data (keyfile, &write->length, NULL);
+    g_key_file_free (keyfile);
+
+    auth_stats_flush ();
+    auth_stats_writer = g_thread_new ("save-auth-stats", auth_stats_write_thread, write);
 }
 
-static JSValueRef
-get_layout_name_cb (JSContextRef context,
-                    JSObjectRef thisObject,
-                    JSStringRef propertyName,
-                    JSValueRef *exception)
+static void
+auth_trace_begin (void)
 {
-    LightDMLayout *layout = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
-
-    string = JSStringCreateWithUTF8CString (lightdm_layout_get_name (layout));
-    return JSValueMakeString (context, string);
+    memset (&auth_trace, 0, sizeof (auth_trace));
+    auth_trace.started = g_get_monotonic_time ();
 }
 
-static JSValueRef
-get_layout_short_description_cb (JSContextRef context,
-                                 JSObjectRef thisObject,
-                                 JSStringRef propertyName,
-                                 JSValueRef *exception)
+static void
+auth_trace_end (gboolean authenticated)
 {
-    LightDMLayout *layout = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    GString *summary;
+    gint i;
 
-    string = JSStringCreateWithUTF8CString (lightdm_layout_get_short_description (layout));
-    return JSValueMakeString (context, string);
+    if (auth_trace.started == 0)
+        return;
+
+    auth_attempts++;
+    if (!authenticated)
+        auth_failures++;
+
+    summary = g_string_new (NULL);
+    for (i = 0; i < AUTH_STEP_COUNT; i++)
+    {
+        auth_last_durations[i] = auth_step_duration (i);
+        if (auth_last_durations[i] < 0)
+            continue;
+
+        auth_histograms[i][auth_histogram_bucket (auth_last_durations[i])]++;
+        g_string_append_printf (summary, " %s=%" G_GINT64_FORMAT "ms", auth_step_names[i], auth_last_durations[i] / 1000);
+    }
+    logMessage(G_LOG_LEVEL_MESSAGE, "Authentication %s after %d prompts:%s", authenticated ? "succeeded" : "failed", auth_trace.n_prompts, summary->str);
+    g_string_free (summary, TRUE);
+
+    memset (&auth_trace, 0, sizeof (auth_trace));
+    auth_stats_save ();
 }
 
 static JSValueRef
-get_layout_description_cb (JSContextRef context,
-                           JSObjectRef thisObject,
-                           JSStringRef propertyName,
-                           JSValueRef *exception)
+get_auth_stats_cb (JSContextRef context,
+                   JSObjectRef thisObject,
+                   JSStringRef propertyName,
+                   JSValueRef *exception)
 {
-    LightDMLayout *layout = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    JSObjectRef stats, last, histograms;
+    JSValueRef counts[AUTH_HISTOGRAM_BUCKETS], bounds[AUTH_HISTOGRAM_BUCKETS];
+    gint i, j;
 
-    string = JSStringCreateWithUTF8CString (lightdm_layout_get_description (layout));
-    return JSValueMakeString (context, string);
+    stats = JSObjectMake (context, NULL, NULL);
+    set_js_property (context, stats, "attempts", JSValueMakeNumber (context, auth_attempts));
+    set_js_property (context, stats, "failures", JSValueMakeNumber (context, auth_failures));
+
+    last = JSObjectMake (context, NULL, NULL);
+    histograms = JSObjectMake (context, NULL, NULL);
+    for (i = 0; i < AUTH_STEP_COUNT; i++)
+    {
+        if (auth_attempts > 0 && auth_last_durations[i] >= 0)
+            set_js_property (context, last, auth_step_names[i], JSValueMakeNumber (context, auth_last_durations[i] / 1000.0));
+        for (j = 0; j < AUTH_HISTOGRAM_BUCKETS; j++)
+            counts[j] = JSValueMakeNumber (context, auth_histograms[i][j]);
+        set_js_property (context, histograms, auth_step_names[i], JSObjectMakeArray (context, AUTH_HISTOGRAM_BUCKETS, counts, NULL));
+    }
+    set_js_property (context, stats, "last_attempt_ms", last);
+    set_js_property (context, stats, "histograms", histograms);
+
+    /* Exclusive upper bound of each bucket in ms, null for the open ended one */
+    for (j = 0; j < AUTH_HISTOGRAM_BUCKETS - 1; j++)
+        bounds[j] = JSValueMakeNumber (context, (gdouble) (1 << j));
+    bounds[AUTH_HISTOGRAM_BUCKETS - 1] = JSValueMakeNull (context);
+    set_js_property (context, stats, "bucket_bounds_ms", JSObjectMakeArray (context, AUTH_HISTOGRAM_BUCKETS, bounds, NULL));
+
+    return stats;
 }
 
-static JSValueRef
-get_session_key_cb (JSContextRef context,
-                    JSObjectRef thisObject,
-                    JSStringRef propertyName,
-                    JSValueRef *exception)
+/* What the last successful login picked, so the theme can preselect without
+ * asking the daemon. Groups: [last] user/session/language, [sessions] user=session */
+static GKeyFile *last_state = NULL;
+
+static void
+last_state_load (void)
 {
-    LightDMSession *session = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    GMappedFile *file;
+    gchar *filename;
 
-    string = JSStringCreateWithUTF8CString (lightdm_session_get_key (session));
-    return JSValueMakeString (context, string);
+    last_state = g_key_file_new ();
 
+    filename = get_cache_filename ("state");
+    file = g_mapped_file_new (filename, FALSE, NULL);
+    if (file != NULL)
+    {
+        if (g_mapped_file_get_length (file) > 0)
+            g_key_file_load_from_data (last_state, g_mapped_file_get_contents (file), g_mapped_file_get_length (file), G_KEY_FILE_NONE, NULL);
+        g_mapped_file_unref (file);
+    }
+    g_free (filename);
 }
-static JSValueRef
-get_session_name_cb (JSContextRef context,
-                     JSObjectRef thisObject,
-                     JSStringRef propertyName,
-                     JSValueRef *exception)
+
+static void
+last_state_save (const gchar *username, const gchar *session, const gchar *language)
 {
-    LightDMSession *session = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    GError *err = NULL;
+    gchar *filename, *dir, *data;
+    gsize length;
 
-    string = JSStringCreateWithUTF8CString (lightdm_session_get_name (session));
-    return JSValueMakeString (context, string);
+    g_key_file_set_string (last_state, "last", "user", username);
+    if (session != NULL)
+    {
+        g_key_file_set_string (last_state, "last", "session", session);
+        g_key_file_set_string (last_state, "sessions", username, session);
+    }
+    else
+        g_key_file_remove_key (last_state, "last", "session", NULL);
+    if (language != NULL)
+        g_key_file_set_string (last_state, "last", "language", language);
+    else
+        g_key_file_remove_key (last_state, "last", "language", NULL);
+
+    /* g_file_set_contents goes through a temporary file and a rename, a
+     * greeter killed half way never leaves a truncated state behind. */
+    filename = get_cache_filename ("state");
+    dir = g_path_get_dirname (filename);
+    g_mkdir_with_parents (dir, 0700);
+    data = g_key_file_to_data (last_state, &length, NULL);
+    if (!g_file_set_contents (filename, data, length, &err)) {
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error writing %s: %s", filename, err->message);
+      g_error_free (err);
+    }
+
+    g_free (data);
+    g_free (dir);
+    g_free (filename);
 }
 
 static JSValueRef
-get_session_comment_cb (JSContextRef context,
-                        JSObjectRef thisObject,
-                        JSStringRef propertyName,
-                        JSValueRef *exception)
+get_last_state_value (JSContextRef context, const gchar *group, const gchar *key)
 {
-    LightDMSession *session = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    gchar *value = g_key_file_get_string (last_state, group, key, NULL);
+    JSValueRef result = make_js_string (context, value);
 
-    string = JSStringCreateWithUTF8CString (lightdm_session_get_comment (session));
-    return JSValueMakeString (context, string);
+    g_free (value);
+    return result;
 }
 
 static JSValueRef
-get_hostname_cb (JSContextRef context,
-                 JSObjectRef thisObject,
-                 JSStringRef propertyName,
-                 JSValueRef *exception)
+get_last_state_cb (JSContextRef context,
+                   JSObjectRef thisObject,
+                   JSStringRef propertyName,
+                   JSValueRef *exception)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    JSObjectRef state, sessions;
+    gchar **users;
+    gsize i, n_users = 0;
+
+    state = JSObjectMake (context, NULL, NULL);
+    set_js_property (context, state, "user", get_last_state_value (context, "last", "user"));
+    set_js_property (context, state, "session", get_last_state_value (context, "last", "session"));
+    set_js_property (context, state, "language", get_last_state_value (context, "last", "language"));
+
+    sessions = JSObjectMake (context, NULL, NULL);
+    users = g_key_file_get_keys (last_state, "sessions", &n_users, NULL);
+    for (i = 0; i < n_users; i++)
+        set_js_property (context, sessions, users[i], get_last_state_value (context, "sessions", users[i]));
+    g_strfreev (users);
+    set_js_property (context, state, "sessions", sessions);
+
+    return state;
+}
 
-    string = JSStringCreateWithUTF8CString (lightdm_get_hostname ());
+/* Opt-in: run the PAM conversation for a likely user ahead of the theme
+ * asking for it, up to the first prompt. What the daemon sends meanwhile is
+ * held back and replayed once the theme starts authenticating that user. */
+typedef enum
+{
+    PREPARED_PROMPT,
+    PREPARED_MESSAGE,
+    PREPARED_COMPLETE
+} PreparedEventType;
 
-    return JSValueMakeString (context, string);
-}
+typedef struct
+{
+    PreparedEventType type;
+    gboolean flag;  /* secret prompt or error message */
+    gchar *text;
+} PreparedEvent;
 
-static JSValueRef
-get_num_users_cb (JSContextRef context,
-                  JSObjectRef thisObject,
-                  JSStringRef propertyName,
-                  JSValueRef *exception)
+static gboolean preauthenticate = FALSE;
+static gchar *prepared_user = NULL;
+static GList *prepared_events = NULL;
+
+static void
+prepared_event_free (PreparedEvent *event)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    gint num_users;
+    g_free (event->text);
+    g_free (event);
+}
 
-    num_users = g_list_length(lightdm_user_list_get_users (lightdm_user_list_get_instance()));
-    return JSValueMakeNumber (context, num_users);
+static void
+clear_prepared_authentication (void)
+{
+    g_free (prepared_user);
+    prepared_user = NULL;
+    g_list_free_full (prepared_events, (GDestroyNotify) prepared_event_free);
+    prepared_events = NULL;
 }
 
-static JSValueRef
-get_users_cb (JSContextRef context,
-              JSObjectRef thisObject,
-              JSStringRef propertyName,
-              JSValueRef *exception)
+static gboolean
+hold_prepared_event (PreparedEventType type, gboolean flag, const gchar *text)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSObjectRef array;
-    const GList *users, *link;
-    guint i, n_users = 0;
-    JSValueRef *args;
+    PreparedEvent *event;
 
-    users = lightdm_user_list_get_users( lightdm_user_list_get_instance() );
-    n_users = g_list_length ((GList *)users);
-    args = g_malloc (sizeof (JSValueRef) * (n_users + 1));
-    for (i = 0, link = users; link; i++, link = link->next)
-    {
-        LightDMUser *user = link->data;
-        g_object_ref (user);
-        args[i] = JSObjectMake (context, lightdm_user_class, user);
-    }
+    if (prepared_user == NULL)
+        return FALSE;
 
-    array = JSObjectMakeArray (context, n_users, args, NULL);
-    g_free (args);
-    return array;
+    event = g_new0 (PreparedEvent, 1);
+    event->type = type;
+    event->flag = flag;
+    event->text = g_strdup (text);
+    prepared_events = g_list_append (prepared_events, event);
+
+    return TRUE;
 }
 
-static JSValueRef
-get_languages_cb (JSContextRef context,
-                  JSObjectRef thisObject,
-                  JSStringRef propertyName,
-                  JSValueRef *exception)
+static void
+prepare_authentication (const gchar *username)
 {
-    JSObjectRef array;
-    const GList *languages, *link;
-    guint i, n_languages = 0;
-    JSValueRef *args;
-
-    languages = lightdm_get_languages ();
-    n_languages = g_list_length ((GList *)languages);
-    args = g_malloc (sizeof (JSValueRef) * (n_languages + 1));
-    for (i = 0, link = languages; link; i++, link = link->next)
-    {
-        LightDMLanguage *language = link->data;
-        g_object_ref (language);
-        args[i] = JSObjectMake (context, lightdm_language_class, language);
-    }
-
-    array = JSObjectMakeArray (context, n_languages, args, NULL);
-    g_free (args);
-    return array;
+    if (g_strcmp0 (prepared_user, username) == 0)
+        return;
+
+    /* A new authenticate supersedes the running conversation, liblightdm
+     * drops anything still in flight for the old one. */
+    clear_prepared_authentication ();
+    prepared_user = g_strdup (username);
+    logMessage(G_LOG_LEVEL_MESSAGE, "Preparing authentication for %s", username);
+    backend->authenticate (username);
 }
 
-static JSValueRef
-get_default_language_cb (JSContextRef context,
-                         JSObjectRef thisObject,
-                         JSStringRef propertyName,
-                         JSValueRef *exception)
+static void
+show_prompt_cb (const gchar *text, gboolean secret)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    WatchdogScope scope;
+    gchar *command;
 
-    string = JSStringCreateWithUTF8CString (lightdm_language_get_name((LightDMLanguage *)lightdm_get_language ()));
+    g_debug("Show prompt %s", text);
 
-    return JSValueMakeString (context, string);
-}
+    if (hold_prepared_event (PREPARED_PROMPT, secret, text))
+        return;
 
-static JSValueRef
-get_default_layout_cb (JSContextRef context,
-                       JSObjectRef thisObject,
-                       JSStringRef propertyName,
-                       JSValueRef *exception)
-{
-    JSStringRef string;
+    if (benchmark_theme != NULL)
+        benchmark_prompted ();
 
-    string = JSStringCreateWithUTF8CString (lightdm_layout_get_name(lightdm_get_layout ()));
+    if (auth_trace.prompted == 0)
+        auth_trace.prompted = g_get_monotonic_time ();
+    auth_trace.n_prompts++;
 
-    return JSValueMakeString (context, string);
+    command = g_strdup_printf ("show_prompt('%s')", text);
+    watchdog_enter (&scope, "show_prompt");
+    webkit_web_view_execute_script (web_view, command);
+    watchdog_leave (&scope);
+    g_free (command);
 }
 
-static JSValueRef
-get_layouts_cb (JSContextRef context,
-                JSObjectRef thisObject,
-                JSStringRef propertyName,
-                JSValueRef *exception)
+static void
+show_message_cb (const gchar *text, gboolean error)
 {
-    JSObjectRef array;
-    const GList *layouts, *link;
-    guint i, n_layouts = 0;
-    JSValueRef *args;
+    WatchdogScope scope;
+    gchar *command;
 
-    layouts = lightdm_get_layouts ();
-    n_layouts = g_list_length ((GList *)layouts);
-    args = g_malloc (sizeof (JSValueRef) * (n_layouts + 1));
-    for (i = 0, link = layouts; link; i++, link = link->next)
-    {
-        LightDMLayout *layout = link->data;
-        g_object_ref (layout);
-        args[i] = JSObjectMake (context, lightdm_layout_class, layout);
-    }
+    if (hold_prepared_event (PREPARED_MESSAGE, error, text))
+        return;
 
-    array = JSObjectMakeArray (context, n_layouts, args, NULL);
-    g_free (args);
-    return array;
+    command = g_strdup_printf ("show_message('%s')", text);
+    watchdog_enter (&scope, "show_message");
+    webkit_web_view_execute_script (web_view, command);
+    watchdog_leave (&scope);
+    g_free (command);
 }
 
-static JSValueRef
-get_layout_cb (JSContextRef context,
-               JSObjectRef thisObject,
-               JSStringRef propertyName,
-               JSValueRef *exception)
+static void
+authentication_complete_cb (void)
 {
-    JSStringRef string;
+    WatchdogScope scope;
 
-    string = JSStringCreateWithUTF8CString (lightdm_layout_get_name(lightdm_get_layout ()));
+    if (hold_prepared_event (PREPARED_COMPLETE, FALSE, NULL))
+        return;
 
-    return JSValueMakeString (context, string);
+    auth_trace.completed = g_get_monotonic_time ();
+    /* Successful attempts are finished by login_cb */
+    if (!backend->get_is_authenticated ())
+        auth_trace_end (FALSE);
+
+    /* The theme usually calls lightdm.login() from here */
+    watchdog_enter (&scope, "authentication_complete");
+    webkit_web_view_execute_script (web_view, "authentication_complete()");
+    watchdog_leave (&scope);
 }
 
-static bool
-set_layout_cb (JSContextRef context,
-               JSObjectRef thisObject,
-               JSStringRef propertyName,
-               JSValueRef value,
-               JSValueRef *exception)
+static gboolean
+replay_prepared_events_cb (gpointer data)
 {
-    JSStringRef layout_arg;
-    char layout[1024];
-
-    // FIXME: Throw exception
-    if (JSValueGetType (context, value) != kJSTypeString)
-        return false;
-
-    layout_arg = JSValueToStringCopy (context, value, NULL);
-    JSStringGetUTF8CString (layout_arg, layout, 1024);
-    JSStringRelease (layout_arg);
+    GList *events, *link;
 
-    //lightdm_set_layout (layout);
+    events = prepared_events;
+    prepared_events = NULL;
+    for (link = events; link; link = link->next)
+    {
+        PreparedEvent *event = link->data;
+
+        switch (event->type)
+        {
+        case PREPARED_PROMPT:
+            show_prompt_cb (event->text, event->flag);
+            break;
+        case PREPARED_MESSAGE:
+            show_message_cb (event->text, event->flag);
+            break;
+        case PREPARED_COMPLETE:
+            authentication_complete_cb ();
+            break;
+        }
+    }
+    g_list_free_full (events, (GDestroyNotify) prepared_event_free);
 
-    return true;
+    return FALSE;
 }
 
-static JSValueRef
-get_sessions_cb (JSContextRef context,
-                 JSObjectRef thisObject,
-                 JSStringRef propertyName,
-                 JSValueRef *exception)
+/* Hands a prepared conversation over to the theme, FALSE if it was for
+ * someone else and has to be started from scratch. */
+static gboolean
+claim_prepared_authentication (const gchar *username)
 {
-    JSObjectRef array;
-    const GList *sessions, *link;
-    guint i, n_sessions = 0;
-    JSValueRef *args;
+    if (prepared_user == NULL)
+        return FALSE;
 
-    sessions = lightdm_get_sessions ();
-    n_sessions = g_list_length ((GList *)sessions);
-    args = g_malloc (sizeof (JSValueRef) * (n_sessions + 1));
-    for (i = 0, link = sessions; link; i++, link = link->next)
+    if (g_strcmp0 (prepared_user, username) != 0)
     {
-        LightDMSession *session = link->data;
-        g_object_ref (session);
-        args[i] = JSObjectMake (context, lightdm_session_class, session);
+        clear_prepared_authentication ();
+        return FALSE;
     }
 
-    array = JSObjectMakeArray (context, n_sessions, args, NULL);
-    g_free (args);
-    return array;
+    g_free (prepared_user);
+    prepared_user = NULL;
+
+    /* Not from inside the JS call that claimed it */
+    g_idle_add (replay_prepared_events_cb, NULL);
+
+    return TRUE;
 }
 
-static JSValueRef
-get_default_session_cb (JSContextRef context,
-                        JSObjectRef thisObject,
-                        JSStringRef propertyName,
-                        JSValueRef *exception)
+static void
+autologin_timeout_expired_cb (void)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    WatchdogScope scope;
+    gchar *command = g_strdup_printf ("autologin_timeout_expired()");
 
-    string = JSStringCreateWithUTF8CString (lightdm_greeter_get_default_session_hint (greeter));
+    watchdog_enter (&scope, "autologin_timeout_expired");
+    webkit_web_view_execute_script (web_view, command);
+    watchdog_leave (&scope);
+    g_free (command);
+}
 
-    return JSValueMakeString (context, string);
+static JSGlobalContextRef
+get_global_context (void)
+{
+    return webkit_web_frame_get_global_context (webkit_web_view_get_main_frame (web_view));
 }
 
-static JSValueRef
-get_timed_login_user_cb (JSContextRef context,
-                         JSObjectRef thisObject,
-                         JSStringRef propertyName,
-                         JSValueRef *exception)
+/* Calls a global function of the theme, themes that do not define it simply
+ * do not get the notification. */
+static void
+call_theme_function (JSContextRef context, const gchar *name, size_t argumentCount, const JSValueRef arguments[])
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef string;
+    WatchdogScope scope;
+    JSStringRef function_name;
+    JSValueRef value;
+    JSObjectRef function;
 
-    string = JSStringCreateWithUTF8CString (lightdm_greeter_get_autologin_user_hint (greeter));
+    function_name = JSStringCreateWithUTF8CString (name);
+    value = JSObjectGetProperty (context, JSContextGetGlobalObject (context), function_name, NULL);
+    JSStringRelease (function_name);
 
-    return JSValueMakeString (context, string);
+    if (value == NULL || !JSValueIsObject (context, value))
+        return;
+
+    function = JSValueToObject (context, value, NULL);
+    if (!JSObjectIsFunction (context, function))
+        return;
+
+    watchdog_enter (&scope, name);
+    JSObjectCallAsFunction (context, function, NULL, argumentCount, arguments, NULL);
+    watchdog_leave (&scope);
 }
 
-static JSValueRef
-get_timed_login_delay_cb (JSContextRef context,
-                          JSObjectRef thisObject,
-                          JSStringRef propertyName,
-                          JSValueRef *exception)
+/* A promise the greeter settles later from C, NULL on engines without
+ * Promise. The resolve function is returned protected. */
+static JSObjectRef
+make_pending_promise (JSContextRef context, JSObjectRef *resolve)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    gint delay;
-
-    delay = lightdm_greeter_get_autologin_timeout_hint (greeter);
-    return JSValueMakeNumber (context, delay);
+    JSStringRef script, resolve_name;
+    JSValueRef value;
+    JSObjectRef promise;
+
+    script = JSStringCreateWithUTF8CString ("typeof Promise === 'function' ? (function () {"
+                                            "  var resolve, promise = new Promise (function (r) { resolve = r; });"
+                                            "  return { promise: promise, resolve: resolve };"
+                                            "}) () : null");
+    value = JSEvaluateScript (context, script, NULL, NULL, 0, NULL);
+    JSStringRelease (script);
+    if (value == NULL || !JSValueIsObject (context, value))
+        return NULL;
+
+    resolve_name = JSStringCreateWithUTF8CString ("resolve");
+    *resolve = JSValueToObject (context, JSObjectGetProperty (context, (JSObjectRef) value, resolve_name, NULL), NULL);
+    JSStringRelease (resolve_name);
+    resolve_name = JSStringCreateWithUTF8CString ("promise");
+    promise = JSValueToObject (context, JSObjectGetProperty (context, (JSObjectRef) value, resolve_name, NULL), NULL);
+    JSStringRelease (resolve_name);
+
+    JSValueProtect (context, *resolve);
+    JSValueProtect (context, promise);
+    return promise;
 }
-static JSValueRef
-cancel_timed_login_cb (JSContextRef context,
-                       JSObjectRef function,
-                       JSObjectRef thisObject,
-                       size_t argumentCount,
-                       const JSValueRef arguments[],
-                       JSValueRef *exception)
+
+static void
+notify_user_cb (BackendUser *user, const gchar *function_name)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
+    JSContextRef context;
+    JSValueRef args[1];
 
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    /* Nothing to update before the theme has its lightdm object */
+    if (lightdm_user_class == NULL)
+        return;
 
-    lightdm_greeter_cancel_autologin (greeter);
-    return JSValueMakeNull (context);
+    context = get_global_context ();
+    args[0] = JSObjectMake (context, lightdm_user_class, backend->user_ref (user));
+    call_theme_function (context, function_name, 1, args);
 }
 
-static JSValueRef
-start_authentication_cb (JSContextRef context,
-                         JSObjectRef function,
-                         JSObjectRef thisObject,
-                         size_t argumentCount,
-                         const JSValueRef arguments[],
-                         JSValueRef *exception)
-{
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef name_arg;
-    char name[1024];
-
-    // FIXME: Throw exception
-    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
-        return JSValueMakeNull (context);
+static void schedule_avatar_atlas (void);
+static void invalidate_user_details (void);
 
-    name_arg = JSValueToStringCopy (context, arguments[0], NULL);
-    JSStringGetUTF8CString (name_arg, name, 1024);
-    JSStringRelease (name_arg);
+static void
+user_added_cb (BackendUser *user)
+{
+    g_debug("User added %s", backend->user_get_name (user));
+    notify_user_cb (user, "user_added");
+    schedule_avatar_atlas ();
+    invalidate_user_details ();
+}
 
-    lightdm_greeter_authenticate (greeter, name);
-    return JSValueMakeNull (context);
+static void
+user_changed_cb (BackendUser *user)
+{
+    g_debug("User changed %s", backend->user_get_name (user));
+    notify_user_cb (user, "user_changed");
+    schedule_avatar_atlas ();
+    invalidate_user_details ();
 }
 
-static gchar *
-toGChar(JSStringRef jsstr)
+static void
+user_removed_cb (BackendUser *user)
 {
-  size_t size;
-  gchar *buf;
-  size = JSStringGetMaximumUTF8CStringSize(jsstr);
-  buf = g_malloc0(size);
-  JSStringGetUTF8CString(jsstr, buf, size);
+    g_debug("User removed %s", backend->user_get_name (user));
+    notify_user_cb (user, "user_removed");
+    schedule_avatar_atlas ();
+    invalidate_user_details ();
+}
 
+/* Opacity follows the clock rather than counting ticks, a late frame lands
+ * where it should have been instead of stretching the fade. GTK+ 2 has no
+ * frame clock, the timer runs at the usual 60 Hz refresh. */
+#define FADE_FRAME_MS 16
 
-  return buf;
-}
+static gint fade_duration = 400;
+static gint64 fade_started = 0;
+static guint fade_id = 0;
 
-static JSValueRef
-getJSValueRefFromPropFile(JSContextRef context,
-                           gchar *gUsr,
-                           gchar *gProperty,
-                           gchar* userConfFilename
-                           )
+/* With warm-standby the daemon keeps us between logins, see standby_hide() */
+static gboolean warm_standby = FALSE;
+
+static void standby_hide (void);
+
+static void
+fade_finished (void)
 {
-    //Later we will get this from file.
-    //GKeyFile *keyfile;
-    GKeyFile *keyfile;
-    GError *err = NULL;
-    keyfile = g_key_file_new ();
+    if (warm_standby)
+        standby_hide ();
+    else
+        gtk_main_quit ();
+}
 
-    gboolean fileFound = g_key_file_load_from_file (keyfile, userConfFilename, G_KEY_FILE_NONE, &err);
+static gboolean
+fade_timer_cb (gpointer data)
+{
+    gdouble progress;
 
-    if (fileFound == FALSE) {
-      g_message("Error attempting g_key_file_load_from_file: %s", err->message);
-      g_error_free (err);
-      return JSValueMakeNull (context);
+    progress = (g_get_monotonic_time () - fade_started) / (fade_duration * 1000.0);
+    if (progress >= 1)
+    {
+        fade_id = 0;
+        fade_finished ();
+        return FALSE;
     }
+    /* Eased in, the start of the fade is what the eye follows */
+    gtk_window_set_opacity (GTK_WINDOW (window), 1 - progress * progress);
 
-    //Query the keyfile for property.
+    return TRUE;
+}
 
-    gchar *gResult = g_key_file_get_string(keyfile, gUsr, gProperty, &err);
-    if (gResult == NULL) {
-      g_message("Error attempting g_key_file_get_string: %s", err->message);
-      g_error_free (err);
-      return JSValueMakeNull (context);
+static void
+quit_cb (LightDMGreeter *greeter, const gchar *username)
+{
+    /* Without a compositor the opacity does nothing, nobody would see the fade */
+    if (fade_duration <= 0 || !gtk_widget_is_composited (window))
+    {
+        fade_finished ();
+        return;
     }
 
-    //Free keyfile
-    g_key_file_free(keyfile);
+    /* Fade out the greeter */
+    fade_started = g_get_monotonic_time ();
+    fade_id = g_timeout_add_full (G_PRIORITY_HIGH_IDLE, FADE_FRAME_MS, (GSourceFunc) fade_timer_cb, NULL, NULL);
+}
 
-    //Free keyfile
-    JSStringRef result = JSStringCreateWithUTF8CString (gResult);
-    g_free(gResult);
-    JSValueRef ret = JSValueMakeString (context, result);
-    JSStringRelease (result);
+static void
+user_finalize_cb (JSObjectRef object)
+{
+    backend->user_unref (JSObjectGetPrivate (object));
+}
 
+/* Properties of the JS classes, one line per field. Each list expands into
+ * the getter callbacks and into the class's JSStaticValue table, so a new
+ * field is one more line and reads the same way as all the others: its
+ * typed accessor on the wrapped object, a missing string becomes null. */
+#define DEFINE_STRING_GETTER(prefix, field, type, accessor) \
+static JSValueRef \
+get_##prefix##_##field##_cb (JSContextRef context, \
+                            JSObjectRef thisObject, \
+                            JSStringRef propertyName, \
+                            JSValueRef *exception) \
+{ \
+    return make_js_string (context, accessor ((type *) JSObjectGetPrivate (thisObject))); \
+}
 
-    return ret;
+#define DEFINE_BOOLEAN_GETTER(prefix, field, type, accessor) \
+static JSValueRef \
+get_##prefix##_##field##_cb (JSContextRef context, \
+                            JSObjectRef thisObject, \
+                            JSStringRef propertyName, \
+                            JSValueRef *exception) \
+{ \
+    return JSValueMakeBoolean (context, accessor ((type *) JSObjectGetPrivate (thisObject))); \
 }
 
+#define STATIC_VALUE_ENTRY(prefix, field, type, accessor) \
+    { #field, get_##prefix##_##field##_cb, NULL, kJSPropertyAttributeReadOnly },
+
+#define USER_FIELDS(STRING, BOOLEAN) \
+    STRING (user, name, BackendUser, backend->user_get_name) \
+    STRING (user, real_name, BackendUser, backend->user_get_real_name) \
+    STRING (user, display_name, BackendUser, backend->user_get_display_name) \
+    STRING (user, image, BackendUser, backend->user_get_image) \
+    STRING (user, language, BackendUser, backend->user_get_language) \
+    STRING (user, layout, BackendUser, backend->user_get_layout) \
+    STRING (user, session, BackendUser, backend->user_get_session) \
+    BOOLEAN (user, logged_in, BackendUser, backend->user_get_logged_in)
+
+#define LANGUAGE_FIELDS(STRING) \
+    STRING (language, code, LightDMLanguage, lightdm_language_get_code) \
+    STRING (language, name, LightDMLanguage, lightdm_language_get_name) \
+    STRING (language, territory, LightDMLanguage, lightdm_language_get_territory)
+
+#define LAYOUT_FIELDS(STRING) \
+    STRING (layout, name, LightDMLayout, lightdm_layout_get_name) \
+    STRING (layout, short_description, LightDMLayout, lightdm_layout_get_short_description) \
+    STRING (layout, description, LightDMLayout, lightdm_layout_get_description)
+
+USER_FIELDS (DEFINE_STRING_GETTER, DEFINE_BOOLEAN_GETTER)
+LANGUAGE_FIELDS (DEFINE_STRING_GETTER)
+LAYOUT_FIELDS (DEFINE_STRING_GETTER)
+
+/* lightdm_get_sessions() is what the theme starts from, liblightdm applies
+ * the daemon's own rules. It never reloads though, so the greeter watches
+ * the daemon's session directories and rescans them with the same rules
+ * when .desktop files are installed or removed while it is up. */
+#define DEFAULT_SESSIONS_DIRECTORY "/usr/share/lightdm/sessions:/usr/share/xsessions:/usr/share/wayland-sessions"
+#define SESSIONS_RESCAN_DELAY_MS 500
+
+typedef struct
+{
+    gint ref_count;
+    gchar *key;
+    gchar *name;
+    gchar *comment;
+} Session;
+
+static gchar **sessions_directories = NULL;
+static GPtrArray *sessions = NULL;
+static GList *sessions_monitors = NULL;
+static guint sessions_rescan_id = 0;
+
+static Session *
+session_ref (Session *session)
+{
+    session->ref_count++;
+    return session;
+}
 
-static JSValueRef
-getCustomProperty_cb (JSContextRef context,
-                            JSObjectRef function,
-                            JSObjectRef thisObject,
-                            size_t argumentCount,
-                            const JSValueRef arguments[],
-                            JSValueRef *exception)
+static void
+session_unref (Session *session)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef user_arg, prop_arg;
+    if (--session->ref_count > 0)
+        return;
 
-    if (argumentCount != 2) {
-      gchar* retmessage = g_strdup_printf("Wrong argument count on call to getCustomProperty_cb. Should be 2, but was: %zu", argumentCount);
-      g_message(retmessage);
-      g_free(retmessage);
-      return JSValueMakeNull (context);
+    g_free (session->key);
+    g_free (session->name);
+    g_free (session->comment);
+    g_free (session);
+}
+
+static Session *
+session_load (const gchar *path, const gchar *key)
+{
+    GKeyFile *keyfile;
+    Session *session = NULL;
+    gchar *try_exec, *program;
+
+    keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) ||
+        g_key_file_get_boolean (keyfile, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY, NULL) ||
+        g_key_file_get_boolean (keyfile, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_HIDDEN, NULL))
+    {
+        g_key_file_free (keyfile);
+        return NULL;
     }
 
+    /* Same rule as the daemon, sessions whose binary is missing are not offered */
+    try_exec = g_key_file_get_string (keyfile, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_TRY_EXEC, NULL);
+    program = try_exec != NULL ? g_find_program_in_path (try_exec) : NULL;
+    if (try_exec == NULL || program != NULL)
+    {
+        session = g_new0 (Session, 1);
+        session->ref_count = 1;
+        session->key = g_strdup (key);
+        session->name = g_key_file_get_locale_string (keyfile, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME, NULL, NULL);
+        session->comment = g_key_file_get_locale_string (keyfile, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_COMMENT, NULL, NULL);
+        if (session->name == NULL)
+            session->name = g_strdup (key);
+        if (session->comment == NULL)
+            session->comment = g_strdup ("");
+    }
+    g_free (program);
+    g_free (try_exec);
+    g_key_file_free (keyfile);
 
+    return session;
+}
 
-    user_arg = JSValueToStringCopy (context, arguments[0], NULL);
-    prop_arg = JSValueToStringCopy (context, arguments[1], NULL);
+static gint
+compare_sessions (gconstpointer a, gconstpointer b)
+{
+    const Session *session_a = *(Session **) a, *session_b = *(Session **) b;
 
-    if (user_arg == NULL | prop_arg == NULL) {
-      g_message("Error on call to getCustomProperty_cb. Arguments were NULL.");
-      return JSValueMakeNull (context);
-    }
-    //convert strings to a *gchar so we can use it to query the prop file.
-    gchar *gUsr = toGChar(user_arg);
-    gchar *gProperty = toGChar(prop_arg) ;
+    return g_utf8_collate (session_a->name, session_b->name);
+}
 
-    //After we are done using, release the strings.
-    JSStringRelease (user_arg);
-    JSStringRelease (prop_arg);
+static GPtrArray *
+get_backend_sessions (void)
+{
+    GPtrArray *result;
+    const BackendSession *backend_sessions;
+    guint i, n_sessions = 0;
 
-    gchar* userConfFilename = g_strdup_printf("%s/%s/users.conf", THEME_DIR, theme);
+    result = g_ptr_array_new_with_free_func ((GDestroyNotify) session_unref);
+    backend_sessions = backend->get_sessions (&n_sessions);
+    for (i = 0; i < n_sessions; i++)
+    {
+        Session *session = g_new0 (Session, 1);
 
+        session->ref_count = 1;
+        session->key = g_strdup (backend_sessions[i].key);
+        session->name = g_strdup (backend_sessions[i].name);
+        session->comment = g_strdup (backend_sessions[i].comment);
+        g_ptr_array_add (result, session);
+    }
 
-    JSValueRef ret = getJSValueRefFromPropFile(context, gUsr, gProperty, userConfFilename);
-    g_free(userConfFilename);
-    g_free(gUsr);
-    g_free(gProperty);
-    return ret;
+    return result;
 }
 
+static GPtrArray *
+get_daemon_sessions (void)
+{
+    GPtrArray *result;
+    const GList *link;
+
+    result = g_ptr_array_new_with_free_func ((GDestroyNotify) session_unref);
+    for (link = lightdm_get_sessions (); link; link = link->next)
+    {
+        Session *session = g_new0 (Session, 1);
 
+        session->ref_count = 1;
+        session->key = g_strdup (lightdm_session_get_key (link->data));
+        session->name = g_strdup (lightdm_session_get_name (link->data));
+        session->comment = g_strdup (lightdm_session_get_comment (link->data));
+        g_ptr_array_add (result, session);
+    }
+    g_ptr_array_sort (result, compare_sessions);
 
+    return result;
+}
 
-static JSValueRef
-provide_secret_cb (JSContextRef context,
-                   JSObjectRef function,
-                   JSObjectRef thisObject,
-                   size_t argumentCount,
-                   const JSValueRef arguments[],
-                   JSValueRef *exception)
+/* Every *.conf in a lightdm.conf.d, in name order as the daemon reads them */
+static void
+load_daemon_config_dir (const gchar *dir, gchar **sessions_directory)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef secret_arg;
-    char secret[1024];
+    GDir *directory;
+    GList *names = NULL, *link;
+    const gchar *name;
+
+    directory = g_dir_open (dir, 0, NULL);
+    if (directory == NULL)
+        return;
+    while ((name = g_dir_read_name (directory)))
+        if (g_str_has_suffix (name, ".conf"))
+            names = g_list_prepend (names, g_strdup (name));
+    g_dir_close (directory);
+
+    names = g_list_sort (names, (GCompareFunc) g_strcmp0);
+    for (link = names; link; link = link->next)
+    {
+        gchar *path = g_build_filename (dir, link->data, NULL);
+        GKeyFile *keyfile = g_key_file_new ();
+        gchar *value;
+
+        if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) &&
+            (value = g_key_file_get_string (keyfile, "LightDM", "sessions-directory", NULL)) != NULL)
+        {
+            g_free (*sessions_directory);
+            *sessions_directory = value;
+        }
+        g_key_file_free (keyfile);
+        g_free (path);
+    }
+    g_list_free_full (names, g_free);
+}
 
-    // FIXME: Throw exception
-    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
-        return JSValueMakeNull (context);
+/* The daemon's sessions-directory after its whole configuration stack:
+ * lightdm.conf.d under the system data dirs, then under the system config
+ * dirs, then CONFIG_DIR/lightdm.conf.d and last CONFIG_DIR/lightdm.conf,
+ * a later file overriding an earlier one. */
+static gchar *
+get_daemon_sessions_directory (void)
+{
+    const gchar * const *dirs;
+    gchar *sessions_directory = NULL, *dir, *path, *value;
+    GKeyFile *keyfile;
+    gint i;
 
-    secret_arg = JSValueToStringCopy (context, arguments[0], NULL);
-    JSStringGetUTF8CString (secret_arg, secret, 1024);
-    JSStringRelease (secret_arg);
+    dirs = g_get_system_data_dirs ();
+    for (i = g_strv_length ((gchar **) dirs) - 1; i >= 0; i--)
+    {
+        dir = g_build_filename (dirs[i], "lightdm", "lightdm.conf.d", NULL);
+        load_daemon_config_dir (dir, &sessions_directory);
+        g_free (dir);
+    }
+    dirs = g_get_system_config_dirs ();
+    for (i = g_strv_length ((gchar **) dirs) - 1; i >= 0; i--)
+    {
+        dir = g_build_filename (dirs[i], "lightdm", "lightdm.conf.d", NULL);
+        load_daemon_config_dir (dir, &sessions_directory);
+        g_free (dir);
+    }
+    dir = g_build_filename (CONFIG_DIR, "lightdm.conf.d", NULL);
+    load_daemon_config_dir (dir, &sessions_directory);
+    g_free (dir);
 
-    lightdm_greeter_respond (greeter, secret);
+    keyfile = g_key_file_new ();
+    path = g_build_filename (CONFIG_DIR, "lightdm.conf", NULL);
+    if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) &&
+        (value = g_key_file_get_string (keyfile, "LightDM", "sessions-directory", NULL)) != NULL)
+    {
+        g_free (sessions_directory);
+        sessions_directory = value;
+    }
+    g_free (path);
+    g_key_file_free (keyfile);
 
-    return JSValueMakeNull (context);
+    return sessions_directory != NULL ? sessions_directory : g_strdup (DEFAULT_SESSIONS_DIRECTORY);
 }
 
-static JSValueRef
-cancel_authentication_cb (JSContextRef context,
-                          JSObjectRef function,
-                          JSObjectRef thisObject,
-                          size_t argumentCount,
-                          const JSValueRef arguments[],
-                          JSValueRef *exception)
+static GPtrArray *
+scan_sessions (void)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
+    GPtrArray *result;
+    GHashTable *seen;
+    gchar **dir;
 
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    result = g_ptr_array_new_with_free_func ((GDestroyNotify) session_unref);
+    seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (dir = sessions_directories; *dir; dir++)
+    {
+        GDir *directory = g_dir_open (*dir, 0, NULL);
+        const gchar *filename;
+
+        if (directory == NULL)
+            continue;
+
+        while ((filename = g_dir_read_name (directory)))
+        {
+            gchar *key, *path;
+            Session *session;
+
+            if (!g_str_has_suffix (filename, ".desktop"))
+                continue;
+
+            /* Earlier directories win, as in the daemon */
+            key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
+            if (g_hash_table_lookup_extended (seen, key, NULL, NULL))
+            {
+                g_free (key);
+                continue;
+            }
+
+            path = g_build_filename (*dir, filename, NULL);
+            session = session_load (path, key);
+            g_free (path);
+            if (session != NULL)
+                g_ptr_array_add (result, session);
+            g_hash_table_insert (seen, key, NULL);
+        }
+        g_dir_close (directory);
+    }
+    g_hash_table_destroy (seen);
+    g_ptr_array_sort (result, compare_sessions);
 
-    lightdm_greeter_cancel_authentication (greeter);
-    return JSValueMakeNull (context);
+    return result;
 }
 
-static JSValueRef
-get_authentication_user_cb (JSContextRef context,
-                            JSObjectRef thisObject,
-                            JSStringRef propertyName,
-                            JSValueRef *exception)
+static gboolean
+sessions_equal (GPtrArray *a, GPtrArray *b)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    return JSValueMakeString (context, JSStringCreateWithUTF8CString (lightdm_greeter_get_authentication_user (greeter)));
+    guint i;
+
+    if (a->len != b->len)
+        return FALSE;
+
+    for (i = 0; i < a->len; i++)
+    {
+        Session *session_a = g_ptr_array_index (a, i), *session_b = g_ptr_array_index (b, i);
+
+        if (g_strcmp0 (session_a->key, session_b->key) != 0 ||
+            g_strcmp0 (session_a->name, session_b->name) != 0 ||
+            g_strcmp0 (session_a->comment, session_b->comment) != 0)
+            return FALSE;
+    }
+
+    return TRUE;
 }
 
-static JSValueRef
-get_is_authenticated_cb (JSContextRef context,
-                         JSObjectRef thisObject,
-                         JSStringRef propertyName,
-                         JSValueRef *exception)
+static JSObjectRef make_sessions_array (JSContextRef context);
+
+static gboolean
+rescan_sessions_cb (gpointer data)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    return JSValueMakeBoolean (context, lightdm_greeter_get_is_authenticated (greeter));
+    GPtrArray *rescanned;
+    JSContextRef context;
+    JSValueRef args[1];
+
+    sessions_rescan_id = 0;
+
+    rescanned = scan_sessions ();
+    if (sessions_equal (sessions, rescanned))
+    {
+        g_ptr_array_unref (rescanned);
+        return FALSE;
+    }
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Sessions changed, %u available", rescanned->len);
+    g_ptr_array_unref (sessions);
+    sessions = rescanned;
+
+    /* Nothing to update before the theme has its lightdm object */
+    if (lightdm_session_class == NULL)
+        return FALSE;
+
+    context = get_global_context ();
+    if (sessions_array != NULL)
+    {
+        JSValueUnprotect (context, sessions_array);
+        sessions_array = NULL;
+    }
+    args[0] = make_sessions_array (context);
+    call_theme_function (context, "sessions_changed", 1, args);
+
+    return FALSE;
 }
 
-static JSValueRef
-get_can_suspend_cb (JSContextRef context,
-                    JSObjectRef thisObject,
-                    JSStringRef propertyName,
-                    JSValueRef *exception)
+static void
+sessions_directory_changed_cb (GFileMonitor *monitor,
+                               GFile *file,
+                               GFile *other_file,
+                               GFileMonitorEvent event_type,
+                               gpointer data)
 {
-    return JSValueMakeBoolean (context, lightdm_get_can_suspend ());
+    /* Package managers touch several files in a row, rescan once they settle */
+    if (sessions_rescan_id != 0)
+        g_source_remove (sessions_rescan_id);
+    sessions_rescan_id = g_timeout_add (SESSIONS_RESCAN_DELAY_MS, rescan_sessions_cb, NULL);
 }
 
-static JSValueRef
-suspend_cb (JSContextRef context,
-            JSObjectRef function,
-            JSObjectRef thisObject,
-            size_t argumentCount,
-            const JSValueRef arguments[],
-            JSValueRef *exception)
+static void
+watch_sessions (void)
 {
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    gchar *directories;
+    gchar **dir;
 
-    lightdm_suspend(NULL);
-    return JSValueMakeNull (context);
+    /* Nothing on disk to follow when the backend makes them up */
+    if (backend->get_sessions != NULL)
+    {
+        sessions = get_backend_sessions ();
+        return;
+    }
+
+    sessions = get_daemon_sessions ();
+
+    directories = get_daemon_sessions_directory ();
+    sessions_directories = g_strsplit (directories, ":", -1);
+    g_free (directories);
+
+    for (dir = sessions_directories; *dir; dir++)
+    {
+        GFile *file = g_file_new_for_path (*dir);
+        GFileMonitor *monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+
+        if (monitor != NULL)
+        {
+            g_signal_connect (monitor, "changed", G_CALLBACK (sessions_directory_changed_cb), NULL);
+            sessions_monitors = g_list_prepend (sessions_monitors, monitor);
+        }
+        g_object_unref (file);
+    }
 }
 
-static JSValueRef
-get_can_hibernate_cb (JSContextRef context,
-                      JSObjectRef thisObject,
-                      JSStringRef propertyName,
-                      JSValueRef *exception)
+static void
+session_finalize_cb (JSObjectRef object)
 {
-    return JSValueMakeBoolean (context, lightdm_get_can_hibernate ());
+    session_unref (JSObjectGetPrivate (object));
 }
 
-static JSValueRef
-hibernate_cb (JSContextRef context,
-              JSObjectRef function,
-              JSObjectRef thisObject,
-              size_t argumentCount,
-              const JSValueRef arguments[],
-              JSValueRef *exception)
+static const gchar *
+session_get_key (Session *session)
 {
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    return session->key;
+}
 
-    lightdm_hibernate (NULL);
-    return JSValueMakeNull (context);
+static const gchar *
+session_get_name (Session *session)
+{
+    return session->name;
 }
 
-static JSValueRef
-get_can_restart_cb (JSContextRef context,
-                    JSObjectRef thisObject,
-                    JSStringRef propertyName,
-                    JSValueRef *exception)
+static const gchar *
+session_get_comment (Session *session)
 {
-    return JSValueMakeBoolean (context, lightdm_get_can_restart ());
+    return session->comment;
 }
 
-static JSValueRef
-restart_cb (JSContextRef context,
-            JSObjectRef function,
-            JSObjectRef thisObject,
-            size_t argumentCount,
-            const JSValueRef arguments[],
-            JSValueRef *exception)
+#define SESSION_FIELDS(STRING) \
+    STRING (session, key, Session, session_get_key) \
+    STRING (session, name, Session, session_get_name) \
+    STRING (session, comment, Session, session_get_comment)
+
+SESSION_FIELDS (DEFINE_STRING_GETTER)
+
+static gboolean
+read_memory_usage (gint64 *rss_kb, gint64 *peak_rss_kb)
 {
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    gchar *contents, **lines, **line;
 
-    lightdm_restart (NULL);
-    return JSValueMakeNull (context);
+    *rss_kb = *peak_rss_kb = 0;
+    if (!g_file_get_contents ("/proc/self/status", &contents, NULL, NULL))
+        return FALSE;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (line = lines; *line; line++)
+    {
+        if (g_str_has_prefix (*line, "VmRSS:"))
+            *rss_kb = g_ascii_strtoll (*line + strlen ("VmRSS:"), NULL, 10);
+        else if (g_str_has_prefix (*line, "VmHWM:"))
+            *peak_rss_kb = g_ascii_strtoll (*line + strlen ("VmHWM:"), NULL, 10);
+    }
+    g_strfreev (lines);
+    g_free (contents);
+
+    return TRUE;
 }
 
 static JSValueRef
-get_can_shutdown_cb (JSContextRef context,
+get_memory_stats_cb (JSContextRef context,
                      JSObjectRef thisObject,
                      JSStringRef propertyName,
                      JSValueRef *exception)
 {
-    return JSValueMakeBoolean (context, lightdm_get_can_shutdown ());
+    JSObjectRef stats;
+    gint64 rss_kb, peak_rss_kb;
+
+    if (!read_memory_usage (&rss_kb, &peak_rss_kb))
+        return JSValueMakeNull (context);
+
+    stats = JSObjectMake (context, NULL, NULL);
+    set_js_property (context, stats, "profile", make_js_string (context, memory_profile == MEMORY_PROFILE_LOW ? "low" : "default"));
+    set_js_property (context, stats, "rss_kb", JSValueMakeNumber (context, rss_kb));
+    set_js_property (context, stats, "peak_rss_kb", JSValueMakeNumber (context, peak_rss_kb));
+    set_js_property (context, stats, "js_heap_limit_mb", JSValueMakeNumber (context, js_heap_limit));
+
+    return stats;
 }
 
 static JSValueRef
-shutdown_cb (JSContextRef context,
-             JSObjectRef function,
-             JSObjectRef thisObject,
-             size_t argumentCount,
-             const JSValueRef arguments[],
-             JSValueRef *exception)
+get_hostname_cb (JSContextRef context,
+                 JSObjectRef thisObject,
+                 JSStringRef propertyName,
+                 JSValueRef *exception)
 {
-    // FIXME: Throw exception
-    if (argumentCount != 0)
-        return JSValueMakeNull (context);
+    JSStringRef string;
 
-    lightdm_shutdown (NULL);
-    return JSValueMakeNull (context);
+    string = JSStringCreateWithUTF8CString (backend->get_hostname ());
+
+    return JSValueMakeString (context, string);
 }
 
 static JSValueRef
-login_cb (JSContextRef context,
-          JSObjectRef function,
-          JSObjectRef thisObject,
-          size_t argumentCount,
-          const JSValueRef arguments[],
-          JSValueRef *exception)
+get_num_users_cb (JSContextRef context,
+                  JSObjectRef thisObject,
+                  JSStringRef propertyName,
+                  JSValueRef *exception)
 {
-    LightDMGreeter *greeter = JSObjectGetPrivate (thisObject);
-    JSStringRef arg;
-    char username[1024], *session = NULL, *language = NULL;
+    gint num_users;
 
-    // FIXME: Throw exception
+    num_users = g_list_length((GList *) backend->get_users ());
+    return JSValueMakeNumber (context, num_users);
+}
 
-    arg = JSValueToStringCopy (context, arguments[0], NULL);
-    JSStringGetUTF8CString (arg, username, 1024);
-    JSStringRelease (arg);
+static JSValueRef
+get_users_cb (JSContextRef context,
+              JSObjectRef thisObject,
+              JSStringRef propertyName,
+              JSValueRef *exception)
+{
+    JSObjectRef array;
+    const GList *users, *link;
+    guint i, n_users = 0;
+    JSValueRef *args;
+    WatchdogScope scope;
 
-    if (argumentCount > 1)
+    watchdog_enter (&scope, G_STRFUNC);
+    users = backend->get_users ();
+    watchdog_leave (&scope);
+    n_users = g_list_length ((GList *)users);
+    args = g_malloc (sizeof (JSValueRef) * (n_users + 1));
+    for (i = 0, link = users; link; i++, link = link->next)
     {
-        arg = JSValueToStringCopy (context, arguments[1], NULL);
-        session = g_malloc (sizeof (char) * 1024);
-        JSStringGetUTF8CString (arg, session, 1024);
-        JSStringRelease (arg);
+        args[i] = JSObjectMake (context, lightdm_user_class, backend->user_ref (link->data));
     }
 
-    if (argumentCount > 2)
-    {
-        arg = JSValueToStringCopy (context, arguments[1], NULL);
-        language = g_malloc (sizeof (char) * 1024);
-        JSStringGetUTF8CString (arg, language, 1024);
-        JSStringRelease (arg);
+    array = JSObjectMakeArray (context, n_users, args, NULL);
+    g_free (args);
+    return array;
+}
+
+/* The user and session tables are also handed out as plain data: serialized
+ * to one JSON string here and parsed by JavaScriptCore in a single step,
+ * instead of one wrapper per entry and a trip back into C for every field
+ * the theme reads. Themes with thousands of users pick the table, the
+ * wrappers stay for the rest. --benchmark-theme times both. */
+static void
+json_append_string (GString *json, const gchar *value)
+{
+    const gchar *c;
+
+    if (value == NULL)
+    {
+        g_string_append (json, "null");
+        return;
     }
 
-    lightdm_greeter_start_session_sync (greeter, session, NULL);
-    g_free (session);
-    g_free (language);
+    g_string_append_c (json, '"');
+    for (c = value; *c; c++)
+    {
+        switch (*c)
+        {
+        case '"':
+            g_string_append (json, "\\\"");
+            break;
+        case '\\':
+            g_string_append (json, "\\\\");
+            break;
+        default:
+            if ((guchar) *c < 0x20)
+                g_string_append_printf (json, "\\u%04x", (guchar) *c);
+            else
+                g_string_append_c (json, *c);
+            break;
+        }
+    }
+    g_string_append_c (json, '"');
+}
 
-    return JSValueMakeNull (context);
+static void
+json_append_member (GString *json, const gchar *name, const gchar *value)
+{
+    g_string_append_printf (json, "\"%s\":", name);
+    json_append_string (json, value);
+    g_string_append_c (json, ',');
 }
 
-static JSValueRef
-gettext_cb (JSContextRef context,
-            JSObjectRef function,
-            JSObjectRef thisObject,
-            size_t argumentCount,
-            const JSValueRef arguments[],
-            JSValueRef *exception)
+/* The same field lists as the wrappers, see USER_FIELDS. Each expands to an
+ * entry of a JsonMember array for json_append_object. */
+typedef struct
 {
-    JSStringRef string_arg, result;
-    char string[1024];
+    const gchar *name;
+    const gchar *(*get_string) (gpointer object);
+    gboolean (*get_boolean) (gpointer object);
+} JsonMember;
 
-    // FIXME: Throw exception
-    if (argumentCount != 1)
-        return JSValueMakeNull (context);
+#define JSON_STRING_MEMBER(prefix, field, type, accessor) \
+    { #field, (const gchar *(*) (gpointer)) accessor, NULL },
 
-    string_arg = JSValueToStringCopy (context, arguments[0], NULL);
-    JSStringGetUTF8CString (string_arg, string, 1024);
-    JSStringRelease (string_arg);
+#define JSON_BOOLEAN_MEMBER(prefix, field, type, accessor) \
+    { #field, NULL, (gboolean (*) (gpointer)) accessor },
 
-    result = JSStringCreateWithUTF8CString (gettext (string));
-    return JSValueMakeString (context, result);
+static void
+json_append_object (GString *json, gpointer object, const JsonMember *members, guint n_members)
+{
+    guint i;
+
+    g_string_append_c (json, '{');
+    for (i = 0; i < n_members; i++)
+    {
+        if (i > 0)
+            g_string_append_c (json, ',');
+        g_string_append_printf (json, "\"%s\":", members[i].name);
+        if (members[i].get_string != NULL)
+            json_append_string (json, members[i].get_string (object));
+        else
+            g_string_append (json, members[i].get_boolean (object) ? "true" : "false");
+    }
+    g_string_append_c (json, '}');
 }
 
 static JSValueRef
-ngettext_cb (JSContextRef context,
-             JSObjectRef function,
-             JSObjectRef thisObject,
-             size_t argumentCount,
-             const JSValueRef arguments[],
-             JSValueRef *exception)
+make_json_value (JSContextRef context, const gchar *json)
 {
-    JSStringRef string_arg, plural_string_arg, result;
-    char string[1024], plural_string[1024];
-    unsigned int n;
+    JSStringRef string = JSStringCreateWithUTF8CString (json);
+    JSValueRef result = JSValueMakeFromJSONString (context, string);
 
-    // FIXME: Throw exception
-    if (argumentCount != 3)
-        return JSValueMakeNull (context);
+    JSStringRelease (string);
+    return result ? result : JSValueMakeNull (context);
+}
 
-    string_arg = JSValueToStringCopy (context, arguments[0], NULL);
-    JSStringGetUTF8CString (string_arg, string, 1024);
-    JSStringRelease (string_arg);
+static JSValueRef
+get_user_table_cb (JSContextRef context,
+                   JSObjectRef thisObject,
+                   JSStringRef propertyName,
+                   JSValueRef *exception)
+{
+    const JsonMember members[] = { USER_FIELDS (JSON_STRING_MEMBER, JSON_BOOLEAN_MEMBER) };
+    const GList *link;
+    GString *json;
+    JSValueRef result;
 
-    plural_string_arg = JSValueToStringCopy (context, arguments[1], NULL);
-    JSStringGetUTF8CString (plural_string_arg, string, 1024);
-    JSStringRelease (plural_string_arg);
+    json = g_string_new ("[");
+    for (link = backend->get_users (); link; link = link->next)
+    {
+        json_append_object (json, link->data, members, G_N_ELEMENTS (members));
+        if (link->next)
+            g_string_append_c (json, ',');
+    }
+    g_string_append_c (json, ']');
 
-    n = JSValueToNumber (context, arguments[2], NULL);
+    result = make_json_value (context, json->str);
+    g_string_free (json, TRUE);
+    return result;
+}
 
-    result = JSStringCreateWithUTF8CString (ngettext (string, plural_string, n));
-    return JSValueMakeString (context, result);
+/* Hundreds of user tiles mean as many image loads and decodes in WebKit. With
+ * avatar-atlas-size set a worker scales every avatar into one tile of a
+ * single PNG, the theme paints its tiles from that one image. The atlas is
+ * cached under a hash of the avatar set, so a known set of users costs no
+ * more than reading the map. */
+typedef struct
+{
+    gint generation;
+    gint tile_size;
+    GPtrArray *names;
+    GPtrArray *images;
+    gchar *atlas;
+    gchar *filename;
+    gchar *map_filename;
+} AvatarAtlasJob;
+
+static gint avatar_atlas_size = 0;
+/* Bumped on the main loop, read by workers to give up on a superseded set */
+static gint avatar_atlas_generation = 0;
+static guint avatar_atlas_rebuild_id = 0;
+
+/* What lightdm.avatar_atlas hands out as JSON, NULL until built */
+static gchar *avatar_atlas = NULL;
+
+/* User events come in bursts when accounts are added in bulk */
+#define AVATAR_ATLAS_REBUILD_DELAY_MS 500
+
+static void
+avatar_atlas_job_free (AvatarAtlasJob *job)
+{
+    g_ptr_array_unref (job->names);
+    g_ptr_array_unref (job->images);
+    g_free (job->atlas);
+    g_free (job->filename);
+    g_free (job->map_filename);
+    g_free (job);
 }
 
-static const JSStaticValue lightdm_user_values[] =
+/* Path, size and mtime like the theme hash, decoding them all to find out
+ * nothing changed is what the cache is there to avoid */
+static gchar *
+hash_avatars (AvatarAtlasJob *job)
 {
-    { "name", get_user_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "real_name", get_user_real_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "display_name", get_user_display_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "image", get_user_image_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "language", get_user_language_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "layout", get_user_layout_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "session", get_user_session_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "logged_in", get_user_logged_in_cb, NULL, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, NULL, 0 }
-};
+    GChecksum *checksum;
+    gchar *entry, *hash;
+    guint i;
+
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+    entry = g_strdup_printf ("%d", job->tile_size);
+    g_checksum_update (checksum, (const guchar *) entry, -1);
+    g_free (entry);
+    for (i = 0; i < job->names->len; i++)
+    {
+        const gchar *image = g_ptr_array_index (job->images, i);
+        GStatBuf info;
+
+        if (g_stat (image, &info) != 0)
+            continue;
+        entry = g_strdup_printf ("%s:%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT, (gchar *) g_ptr_array_index (job->names, i),
+                                 image, (gint64) info.st_size, (gint64) info.st_mtime);
+        g_checksum_update (checksum, (const guchar *) entry, -1);
+        g_free (entry);
+    }
+    hash = g_strdup (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
 
-static const JSStaticValue lightdm_language_values[] =
+    return hash;
+}
+
+static gboolean
+save_avatar_atlas (GdkPixbuf *pixbuf, const gchar *filename)
 {
-    { "code", get_language_code_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "name", get_language_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "territory", get_language_territory_cb, NULL, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, NULL, 0 }
-};
+    GError *err = NULL;
+    gchar *tmp_filename, *dir;
+    gboolean saved;
+    gint fd;
 
-static const JSStaticValue lightdm_layout_values[] =
+    dir = g_path_get_dirname (filename);
+    g_mkdir_with_parents (dir, 0700);
+
+    /* A name of its own, two workers may be saving the same set */
+    tmp_filename = g_strdup_printf ("%s.XXXXXX", filename);
+    fd = g_mkstemp (tmp_filename);
+    if (fd < 0)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Error creating %s", tmp_filename);
+        g_free (dir);
+        g_free (tmp_filename);
+        return FALSE;
+    }
+    g_close (fd, NULL);
+
+    saved = gdk_pixbuf_save (pixbuf, tmp_filename, "png", &err, "compression", "1", NULL);
+    if (saved)
+        g_rename (tmp_filename, filename);
+    else {
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error saving avatar atlas %s: %s", tmp_filename, err->message);
+      g_error_free (err);
+      g_unlink (tmp_filename);
+    }
+
+    g_free (dir);
+    g_free (tmp_filename);
+
+    return saved;
+}
+
+/* Tiles go row by row into a roughly square image, avatars that do not load
+ * get no tile and the theme falls back to user.image for them */
+static gchar *
+build_avatar_atlas (AvatarAtlasJob *job, const gchar *filename)
 {
-    { "name", get_layout_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "short_description", get_layout_short_description_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "description", get_layout_description_cb, NULL, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, NULL, 0 }
-};
+    GPtrArray *avatars;
+    GdkPixbuf *atlas;
+    GString *json;
+    gchar *uri;
+    gint tile = job->tile_size, columns = 1, rows, slot = 0;
+    guint i, n_loaded = 0;
+
+    avatars = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+    for (i = 0; i < job->images->len; i++)
+    {
+        GdkPixbuf *avatar = gdk_pixbuf_new_from_file_at_scale (g_ptr_array_index (job->images, i), tile, tile, TRUE, NULL);
 
-static const JSStaticValue lightdm_session_values[] =
+        g_ptr_array_add (avatars, avatar);
+        if (avatar != NULL)
+            n_loaded++;
+    }
+    if (n_loaded == 0)
+    {
+        g_ptr_array_unref (avatars);
+        return NULL;
+    }
+
+    while ((guint) (columns * columns) < n_loaded)
+        columns++;
+    rows = (n_loaded + columns - 1) / columns;
+    atlas = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, columns * tile, rows * tile);
+    gdk_pixbuf_fill (atlas, 0);
+
+    json = g_string_new ("{\"avatars\":{");
+    for (i = 0; i < avatars->len; i++)
+    {
+        GdkPixbuf *avatar = g_ptr_array_index (avatars, i);
+        gint x, y, width, height;
+
+        if (avatar == NULL)
+            continue;
+
+        x = (slot % columns) * tile;
+        y = (slot / columns) * tile;
+        width = gdk_pixbuf_get_width (avatar);
+        height = gdk_pixbuf_get_height (avatar);
+        gdk_pixbuf_copy_area (avatar, 0, 0, width, height, atlas, x + (tile - width) / 2, y + (tile - height) / 2);
+
+        if (slot++ > 0)
+            g_string_append_c (json, ',');
+        json_append_string (json, g_ptr_array_index (job->names, i));
+        g_string_append_printf (json, ":{\"x\":%d,\"y\":%d}", x, y);
+    }
+    g_ptr_array_unref (avatars);
+
+    uri = g_filename_to_uri (filename, NULL, NULL);
+    g_string_append (json, "},\"image\":");
+    json_append_string (json, uri);
+    g_string_append_printf (json, ",\"size\":%d,\"width\":%d,\"height\":%d}", tile, columns * tile, rows * tile);
+    g_free (uri);
+
+    if (!save_avatar_atlas (atlas, filename))
+    {
+        g_string_free (json, TRUE);
+        json = NULL;
+    }
+    g_object_unref (atlas);
+
+    return json ? g_string_free (json, FALSE) : NULL;
+}
+
+/* Only the published set is ever read again, older ones would pile up with
+ * every change to the users */
+static void
+prune_avatar_atlases (const gchar *filename, const gchar *map_filename)
 {
-    { "key", get_session_key_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "name", get_session_name_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "comment", get_session_comment_cb, NULL, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, NULL, 0 }
-};
+    gchar *dir = g_path_get_dirname (filename);
+    GDir *directory = g_dir_open (dir, 0, NULL);
+    const gchar *name;
 
-static const JSStaticValue lightdm_greeter_values[] =
+    while (directory != NULL && (name = g_dir_read_name (directory)))
+    {
+        gchar *path;
+
+        if (!g_str_has_prefix (name, "avatars-") ||
+            !(g_str_has_suffix (name, ".png") || g_str_has_suffix (name, ".json")))
+            continue;
+
+        path = g_build_filename (dir, name, NULL);
+        if (g_strcmp0 (path, filename) != 0 && g_strcmp0 (path, map_filename) != 0)
+            g_unlink (path);
+        g_free (path);
+    }
+
+    if (directory != NULL)
+        g_dir_close (directory);
+    g_free (dir);
+}
+
+static gboolean
+avatar_atlas_done_cb (gpointer data)
 {
-    { "hostname", get_hostname_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "users", get_users_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "default_language", get_default_language_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "languages", get_languages_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "default_layout", get_default_layout_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "layouts", get_layouts_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "layout", get_layout_cb, set_layout_cb, kJSPropertyAttributeReadOnly },
-    { "sessions", get_sessions_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "num_users", get_num_users_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "default_session", get_default_session_cb, NULL, kJSPropertyAttributeNone },
-    { "timed_login_user", get_timed_login_user_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "timed_login_delay", get_timed_login_delay_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "authentication_user", get_authentication_user_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "is_authenticated", get_is_authenticated_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "can_suspend", get_can_suspend_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "can_hibernate", get_can_hibernate_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "can_restart", get_can_restart_cb, NULL, kJSPropertyAttributeReadOnly },
-    { "can_shutdown", get_can_shutdown_cb, NULL, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, NULL, 0 }
-};
+    AvatarAtlasJob *job = data;
+    JSContextRef context;
+    JSValueRef args[1];
 
-static const JSStaticFunction lightdm_greeter_functions[] =
+    /* Superseded by a rebuild started meanwhile, or nothing changed */
+    if (job->generation != avatar_atlas_generation || g_strcmp0 (job->atlas, avatar_atlas) == 0)
+    {
+        avatar_atlas_job_free (job);
+        return FALSE;
+    }
+
+    g_free (avatar_atlas);
+    avatar_atlas = job->atlas;
+    job->atlas = NULL;
+    if (avatar_atlas != NULL)
+        prune_avatar_atlases (job->filename, job->map_filename);
+    avatar_atlas_job_free (job);
+
+    /* Nothing to update before the theme has its lightdm object */
+    if (lightdm_user_class == NULL)
+        return FALSE;
+
+    context = get_global_context ();
+    args[0] = avatar_atlas ? make_json_value (context, avatar_atlas) : JSValueMakeNull (context);
+    call_theme_function (context, "avatar_atlas_changed", 1, args);
+
+    return FALSE;
+}
+
+static gpointer
+avatar_atlas_thread (gpointer data)
 {
-    { "cancel_timed_login", cancel_timed_login_cb, kJSPropertyAttributeReadOnly },
-    { "start_authentication", start_authentication_cb, kJSPropertyAttributeReadOnly },
-    { "provide_secret", provide_secret_cb, kJSPropertyAttributeReadOnly },
-    { "cancel_authentication", cancel_authentication_cb, kJSPropertyAttributeReadOnly },
-    { "suspend", suspend_cb, kJSPropertyAttributeReadOnly },
-    { "hibernate", hibernate_cb, kJSPropertyAttributeReadOnly },
-    { "restart", restart_cb, kJSPropertyAttributeReadOnly },
-    { "shutdown", shutdown_cb, kJSPropertyAttributeReadOnly },
-    { "login", login_cb, kJSPropertyAttributeReadOnly },
-    { "getCustomProperty", getCustomProperty_cb, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, 0 }
-};
+    AvatarAtlasJob *job = data;
+    gchar *hash, *name;
+
+    hash = hash_avatars (job);
+    name = g_strdup_printf ("avatars-%s.png", hash);
+    job->filename = get_cache_filename (name);
+    g_free (name);
+    name = g_strdup_printf ("avatars-%s.json", hash);
+    job->map_filename = get_cache_filename (name);
+    g_free (name);
+
+    /* No point decoding every avatar for a set that is already outdated */
+    if ((!g_file_test (job->filename, G_FILE_TEST_EXISTS) ||
+         !g_file_get_contents (job->map_filename, &job->atlas, NULL, NULL)) &&
+        job->generation == g_atomic_int_get (&avatar_atlas_generation))
+    {
+        job->atlas = build_avatar_atlas (job, job->filename);
+        if (job->atlas != NULL)
+            g_file_set_contents (job->map_filename, job->atlas, -1, NULL);
+    }
 
-static const JSStaticFunction gettext_functions[] =
+    g_free (hash);
+    g_idle_add (avatar_atlas_done_cb, job);
+
+    return NULL;
+}
+
+static gboolean
+start_avatar_atlas (gpointer data)
 {
-    { "gettext", gettext_cb, kJSPropertyAttributeReadOnly },
-    { "ngettext", ngettext_cb, kJSPropertyAttributeReadOnly },
-    { NULL, NULL, 0 }
-};
+    AvatarAtlasJob *job;
+    const GList *link;
 
-static const JSClassDefinition lightdm_user_definition =
+    avatar_atlas_rebuild_id = 0;
+
+    job = g_new0 (AvatarAtlasJob, 1);
+    job->generation = g_atomic_int_add (&avatar_atlas_generation, 1) + 1;
+    job->tile_size = avatar_atlas_size;
+    job->names = g_ptr_array_new_with_free_func (g_free);
+    job->images = g_ptr_array_new_with_free_func (g_free);
+    for (link = backend->get_users (); link; link = link->next)
+    {
+        const gchar *image = backend->user_get_image (link->data);
+
+        if (image == NULL || image[0] == '\0')
+            continue;
+        g_ptr_array_add (job->names, g_strdup (backend->user_get_name (link->data)));
+        g_ptr_array_add (job->images, g_strdup (image));
+    }
+
+    g_thread_unref (g_thread_new ("avatar-atlas", avatar_atlas_thread, job));
+
+    return FALSE;
+}
+
+static void
+schedule_avatar_atlas (void)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "LightDMUser",             /* Class name */
-    NULL,                  /* Parent class */
-    lightdm_user_values,       /* Static values */
-};
+    if (avatar_atlas_size <= 0)
+        return;
+
+    if (avatar_atlas_rebuild_id != 0)
+        g_source_remove (avatar_atlas_rebuild_id);
+    avatar_atlas_rebuild_id = g_timeout_add (AVATAR_ATLAS_REBUILD_DELAY_MS, start_avatar_atlas, NULL);
+}
+
+static JSValueRef
+get_avatar_atlas_cb (JSContextRef context,
+                     JSObjectRef thisObject,
+                     JSStringRef propertyName,
+                     JSValueRef *exception)
+{
+    if (avatar_atlas == NULL)
+        return JSValueMakeNull (context);
+
+    return make_json_value (context, avatar_atlas);
+}
+
+/* liblightdm builds its language list from `locale -a` and its layout list
+ * from the XKB registry, both slow enough to notice on the first read. A
+ * worker walks both at start-up, liblightdm keeps what it found so later
+ * calls on the main thread are cheap. Until then nothing here touches
+ * liblightdm: the list getters hand out a promise, the rest answer null. */
+typedef struct
+{
+    JSObjectRef promise;
+    JSObjectRef resolve;
+} PendingArray;
+
+static gboolean enumeration_done = FALSE;
+static PendingArray pending_languages, pending_layouts;
+
+/* Applied once the worker is done, compiling them needs the XKB engine
+ * liblightdm is busy with meanwhile */
+static gchar **keyboard_layouts = NULL;
+static gboolean layout_pending = FALSE;
+
+static gboolean switch_layout (const gchar *name);
+static void compile_layouts (gchar **names);
+static JSObjectRef make_languages_array (JSContextRef context);
+static JSObjectRef make_layouts_array (JSContextRef context);
+
+static void
+clear_pending_array (JSContextRef context, PendingArray *pending)
+{
+    if (pending->promise == NULL)
+        return;
+
+    JSValueUnprotect (context, pending->promise);
+    JSValueUnprotect (context, pending->resolve);
+    pending->promise = NULL;
+    pending->resolve = NULL;
+}
+
+static JSValueRef
+get_pending_array (JSContextRef context, PendingArray *pending)
+{
+    if (pending->promise == NULL)
+        pending->promise = make_pending_promise (context, &pending->resolve);
+    if (pending->promise == NULL)
+        return JSValueMakeNull (context);
+
+    return pending->promise;
+}
+
+static void
+resolve_pending_array (JSContextRef context, PendingArray *pending, JSObjectRef array)
+{
+    JSValueRef args[1];
+
+    if (pending->promise == NULL)
+        return;
+
+    args[0] = array;
+    JSObjectCallAsFunction (context, pending->resolve, NULL, 1, args, NULL);
+    clear_pending_array (context, pending);
+}
+
+static gboolean
+enumerate_done_cb (gpointer data)
+{
+    JSContextRef context;
+
+    enumeration_done = TRUE;
+    logMessage(G_LOG_LEVEL_MESSAGE, "Enumerated %u languages and %u keyboard layouts",
+               g_list_length ((GList *) lightdm_get_languages ()), g_list_length ((GList *) lightdm_get_layouts ()));
+
+    compile_layouts (keyboard_layouts);
+    g_strfreev (keyboard_layouts);
+    keyboard_layouts = NULL;
+
+    if (layout_pending && !switch_layout (current_layout))
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Unknown keyboard layout %s", current_layout);
+        g_free (current_layout);
+        current_layout = NULL;
+    }
+    layout_pending = FALSE;
+
+    /* Nothing was handed out before the theme has its lightdm object */
+    if (lightdm_greeter_class == NULL)
+        return FALSE;
+
+    context = get_global_context ();
+    if (pending_languages.promise != NULL)
+        resolve_pending_array (context, &pending_languages, make_languages_array (context));
+    if (pending_layouts.promise != NULL)
+        resolve_pending_array (context, &pending_layouts, make_layouts_array (context));
+
+    return FALSE;
+}
+
+static gpointer
+enumerate_thread (gpointer data)
+{
+    lightdm_get_languages ();
+    lightdm_get_layouts ();
+    g_idle_add (enumerate_done_cb, NULL);
+
+    return NULL;
+}
+
+static void
+start_enumeration (void)
+{
+    g_thread_unref (g_thread_new ("enumerate", enumerate_thread, NULL));
+}
+
+/* AccountsService knows more about an account than liblightdm passes on.
+ * lightdm.get_user_details() fetches it for every user in one batch: a
+ * GetAll per account, all in flight at once on the system bus, handed to
+ * the theme when the last reply is in. Kept until a user is added, changed
+ * or removed or a session ends, a fetch that failed is not kept at all: at
+ * boot AccountsService or the bus may simply not be up yet. */
+#define ACCOUNTS_SERVICE "org.freedesktop.Accounts"
+#define ACCOUNTS_PATH "/org/freedesktop/Accounts"
+#define ACCOUNTS_USER_INTERFACE "org.freedesktop.Accounts.User"
+
+typedef struct
+{
+    GString *json;
+    guint pending;
+    guint generation;
+    gboolean failed;
+} UserDetailsFetch;
+
+/* JSON object keyed by user name, NULL until fetched */
+static gchar *user_details = NULL;
+static gboolean user_details_fetching = FALSE;
+static guint user_details_generation = 0;
+static PendingArray pending_user_details;
+
+/* The next lightdm.get_user_details() fetches again, one in flight is
+ * still handed to the theme but not kept */
+static void
+invalidate_user_details (void)
+{
+    g_free (user_details);
+    user_details = NULL;
+    user_details_generation++;
+}
+
+static void
+finish_user_details (UserDetailsFetch *fetch)
+{
+    JSContextRef context;
+    JSValueRef args[1];
+    gchar *details;
+
+    if (fetch->json->str[fetch->json->len - 1] == ',')
+        g_string_truncate (fetch->json, fetch->json->len - 1);
+    g_string_append_c (fetch->json, '}');
+    details = g_string_free (fetch->json, FALSE);
+    user_details_fetching = FALSE;
+    if (!fetch->failed && fetch->generation == user_details_generation)
+    {
+        g_free (user_details);
+        user_details = g_strdup (details);
+    }
+    g_free (fetch);
+
+    /* Nothing to update before the theme has its lightdm object */
+    if (lightdm_user_class == NULL)
+    {
+        g_free (details);
+        return;
+    }
+
+    context = get_global_context ();
+    args[0] = make_json_value (context, details);
+    g_free (details);
+    if (pending_user_details.promise != NULL && JSValueIsObject (context, args[0]))
+        resolve_pending_array (context, &pending_user_details, (JSObjectRef) args[0]);
+    else
+        call_theme_function (context, "user_details_ready", 1, args);
+}
+
+static void
+json_append_detail (GString *json, GVariant *properties, const gchar *name, const gchar *property)
+{
+    const gchar *value = NULL;
+
+    g_variant_lookup (properties, property, "&s", &value);
+    /* AccountsService reports unset as empty */
+    json_append_member (json, name, value && value[0] ? value : NULL);
+}
+
+static void
+get_user_properties_cb (GObject *connection, GAsyncResult *result, gpointer data)
+{
+    UserDetailsFetch *fetch = data;
+    GVariant *reply, *properties;
+    const gchar *name = NULL;
+    gint32 account_type = 0;
+    gint64 login_time = 0;
+    gboolean locked = FALSE;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (connection), result, NULL);
+    if (reply != NULL)
+    {
+        properties = g_variant_get_child_value (reply, 0);
+        if (g_variant_lookup (properties, "UserName", "&s", &name))
+        {
+            g_variant_lookup (properties, "AccountType", "i", &account_type);
+            g_variant_lookup (properties, "LoginTime", "x", &login_time);
+            g_variant_lookup (properties, "Locked", "b", &locked);
+
+            json_append_string (fetch->json, name);
+            g_string_append (fetch->json, ":{");
+            json_append_detail (fetch->json, properties, "real_name", "RealName");
+            json_append_detail (fetch->json, properties, "email", "Email");
+            json_append_detail (fetch->json, properties, "icon", "IconFile");
+            json_append_detail (fetch->json, properties, "language", "Language");
+            json_append_detail (fetch->json, properties, "session", "XSession");
+            json_append_member (fetch->json, "account_type", account_type == 1 ? "administrator" : "standard");
+            if (login_time > 0)
+                g_string_append_printf (fetch->json, "\"login_time\":%" G_GINT64_FORMAT ",", login_time);
+            else
+                g_string_append (fetch->json, "\"login_time\":null,");
+            g_string_append_printf (fetch->json, "\"locked\":%s},", locked ? "true" : "false");
+        }
+        g_variant_unref (properties);
+        g_variant_unref (reply);
+    }
+    else
+        fetch->failed = TRUE;
+
+    if (--fetch->pending == 0)
+        finish_user_details (fetch);
+}
+
+static void
+list_users_cb (GObject *connection, GAsyncResult *result, gpointer data)
+{
+    UserDetailsFetch *fetch = data;
+    GError *err = NULL;
+    GVariant *reply;
+    GVariantIter *paths;
+    const gchar *path;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (connection), result, &err);
+    if (reply == NULL)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Cannot list users from AccountsService: %s", err->message);
+        g_error_free (err);
+        fetch->failed = TRUE;
+        finish_user_details (fetch);
+        return;
+    }
+
+    /* One extra so the count cannot hit zero before every call is out */
+    fetch->pending = 1;
+    g_variant_get (reply, "(ao)", &paths);
+    while (g_variant_iter_next (paths, "&o", &path))
+    {
+        fetch->pending++;
+        g_dbus_connection_call (G_DBUS_CONNECTION (connection), ACCOUNTS_SERVICE, path,
+                                "org.freedesktop.DBus.Properties", "GetAll",
+                                g_variant_new ("(s)", ACCOUNTS_USER_INTERFACE), G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE, -1, NULL, get_user_properties_cb, fetch);
+    }
+    g_variant_iter_free (paths);
+    g_variant_unref (reply);
+
+    if (--fetch->pending == 0)
+        finish_user_details (fetch);
+}
+
+static void
+system_bus_cb (GObject *source, GAsyncResult *result, gpointer data)
+{
+    UserDetailsFetch *fetch = data;
+    GError *err = NULL;
+    GDBusConnection *connection;
+
+    connection = g_bus_get_finish (result, &err);
+    if (connection == NULL)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Cannot reach the system bus for user details: %s", err->message);
+        g_error_free (err);
+        fetch->failed = TRUE;
+        finish_user_details (fetch);
+        return;
+    }
+
+    g_dbus_connection_call (connection, ACCOUNTS_SERVICE, ACCOUNTS_PATH, ACCOUNTS_SERVICE, "ListCachedUsers",
+                            NULL, G_VARIANT_TYPE ("(ao)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, list_users_cb, fetch);
+    g_object_unref (connection);
+}
+
+static void
+fetch_user_details (void)
+{
+    UserDetailsFetch *fetch;
+
+    if (user_details_fetching)
+        return;
+
+    user_details_fetching = TRUE;
+    fetch = g_new0 (UserDetailsFetch, 1);
+    fetch->json = g_string_new ("{");
+    fetch->generation = user_details_generation;
+    g_bus_get (G_BUS_TYPE_SYSTEM, NULL, system_bus_cb, fetch);
+}
+
+/* A promise of the details, null on engines without Promise, where the
+ * theme's user_details_ready() gets them instead */
+static JSValueRef
+get_user_details_cb (JSContextRef context,
+                     JSObjectRef function,
+                     JSObjectRef thisObject,
+                     size_t argumentCount,
+                     const JSValueRef arguments[],
+                     JSValueRef *exception)
+{
+    JSValueRef promise, details;
+
+    promise = get_pending_array (context, &pending_user_details);
+    if (user_details == NULL)
+    {
+        fetch_user_details ();
+        return promise;
+    }
+
+    details = make_json_value (context, user_details);
+    if (pending_user_details.promise != NULL && JSValueIsObject (context, details))
+        resolve_pending_array (context, &pending_user_details, (JSObjectRef) details);
+    else
+        call_theme_function (context, "user_details_ready", 1, &details);
+
+    return promise;
+}
+
+static JSObjectRef
+make_languages_array (JSContextRef context)
+{
+    const GList *languages, *link;
+    guint i, n_languages = 0;
+    JSValueRef *args;
+
+    languages = lightdm_get_languages ();
+    n_languages = g_list_length ((GList *)languages);
+    args = g_malloc (sizeof (JSValueRef) * (n_languages + 1));
+    for (i = 0, link = languages; link; i++, link = link->next)
+    {
+        LightDMLanguage *language = link->data;
+        g_object_ref (language);
+        args[i] = JSObjectMake (context, lightdm_language_class, language);
+    }
+
+    languages_array = JSObjectMakeArray (context, n_languages, args, NULL);
+    JSValueProtect (context, languages_array);
+    g_free (args);
+    return languages_array;
+}
+
+static JSValueRef
+get_languages_cb (JSContextRef context,
+                  JSObjectRef thisObject,
+                  JSStringRef propertyName,
+                  JSValueRef *exception)
+{
+    if (languages_array != NULL)
+        return languages_array;
+    if (!enumeration_done)
+        return get_pending_array (context, &pending_languages);
+
+    return make_languages_array (context);
+}
+
+static JSValueRef
+get_default_language_cb (JSContextRef context,
+                         JSObjectRef thisObject,
+                         JSStringRef propertyName,
+                         JSValueRef *exception)
+{
+    JSStringRef string;
+
+    if (!enumeration_done)
+        return JSValueMakeNull (context);
+
+    string = JSStringCreateWithUTF8CString (lightdm_language_get_name((LightDMLanguage *)lightdm_get_language ()));
+
+    return JSValueMakeString (context, string);
+}
+
+static JSValueRef
+get_default_layout_cb (JSContextRef context,
+                       JSObjectRef thisObject,
+                       JSStringRef propertyName,
+                       JSValueRef *exception)
+{
+    JSStringRef string;
+
+    if (!enumeration_done)
+        return JSValueMakeNull (context);
+
+    string = JSStringCreateWithUTF8CString (lightdm_layout_get_name(lightdm_get_layout ()));
+
+    return JSValueMakeString (context, string);
+}
+
+static JSObjectRef
+make_layouts_array (JSContextRef context)
+{
+    const GList *layouts, *link;
+    guint i, n_layouts = 0;
+    JSValueRef *args;
+
+    layouts = lightdm_get_layouts ();
+    n_layouts = g_list_length ((GList *)layouts);
+    args = g_malloc (sizeof (JSValueRef) * (n_layouts + 1));
+    for (i = 0, link = layouts; link; i++, link = link->next)
+    {
+        LightDMLayout *layout = link->data;
+        g_object_ref (layout);
+        args[i] = JSObjectMake (context, lightdm_layout_class, layout);
+    }
+
+    layouts_array = JSObjectMakeArray (context, n_layouts, args, NULL);
+    JSValueProtect (context, layouts_array);
+    g_free (args);
+    return layouts_array;
+}
+
+static JSValueRef
+get_layouts_cb (JSContextRef context,
+                JSObjectRef thisObject,
+                JSStringRef propertyName,
+                JSValueRef *exception)
+{
+    if (layouts_array != NULL)
+        return layouts_array;
+    if (!enumeration_done)
+        return get_pending_array (context, &pending_layouts);
+
+    return make_layouts_array (context);
+}
+
+static JSValueRef
+get_layout_cb (JSContextRef context,
+               JSObjectRef thisObject,
+               JSStringRef propertyName,
+               JSValueRef *exception)
+{
+    JSStringRef string;
+    JSValueRef value;
+
+    if (current_layout != NULL)
+        string = JSStringCreateWithUTF8CString (current_layout);
+    else if (!enumeration_done)
+        return JSValueMakeNull (context);
+    else
+        string = JSStringCreateWithUTF8CString (lightdm_layout_get_name(lightdm_get_layout ()));
+    value = JSValueMakeString (context, string);
+    JSStringRelease (string);
+
+    return value;
+}
+
+/* Builds one keymap holding every configured layout as its own XKB group */
+static void
+compile_layouts (gchar **names)
+{
+    XklConfigRec *config;
+    gchar **layouts, **variants;
+    guint i, n_layouts, max_groups;
+
+    if (names == NULL || names[0] == NULL)
+        return;
+
+    xkl_engine = xkl_engine_get_instance (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()));
+    if (xkl_engine == NULL)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "No XKB support, keyboard-layouts ignored");
+        return;
+    }
+
+    n_layouts = g_strv_length (names);
+    max_groups = xkl_engine_get_max_num_groups (xkl_engine);
+    if (n_layouts > max_groups)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Only the first %u of %u keyboard-layouts fit in one keymap", max_groups, n_layouts);
+        n_layouts = max_groups;
+    }
+
+    layouts = g_new0 (gchar *, n_layouts + 1);
+    variants = g_new0 (gchar *, n_layouts + 1);
+    layout_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; i < n_layouts; i++)
+    {
+        /* Same "layout<tab>variant" form LightDMLayout names use */
+        gchar **parts = g_strsplit (g_strstrip (names[i]), "\t", 2);
+
+        layouts[i] = g_strdup (parts[0]);
+        variants[i] = g_strdup (parts[0] && parts[1] ? parts[1] : "");
+        g_hash_table_insert (layout_groups, g_strdup (names[i]), GINT_TO_POINTER (i + 1));
+        g_strfreev (parts);
+    }
+
+    config = xkl_config_rec_new ();
+    xkl_config_rec_get_from_server (config, xkl_engine);
+    xkl_config_rec_set_layouts (config, (const gchar **) layouts);
+    xkl_config_rec_set_variants (config, (const gchar **) variants);
+    if (xkl_config_rec_activate (config, xkl_engine))
+        logMessage(G_LOG_LEVEL_MESSAGE, "Compiled %u keyboard layouts into one keymap", n_layouts);
+    else
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Could not activate keyboard-layouts, falling back to per switch configuration");
+        g_hash_table_destroy (layout_groups);
+        layout_groups = NULL;
+    }
+
+    g_object_unref (config);
+    g_strfreev (layouts);
+    g_strfreev (variants);
+}
+
+static gboolean
+switch_layout (const gchar *name)
+{
+    const GList *link;
+    gint group;
+
+    group = layout_groups ? GPOINTER_TO_INT (g_hash_table_lookup (layout_groups, name)) : 0;
+    if (group > 0)
+    {
+        xkl_engine_lock_group (xkl_engine, group - 1);
+        return TRUE;
+    }
+
+    /* Not compiled in, let liblightdm reconfigure the server */
+    for (link = lightdm_get_layouts (); link; link = link->next)
+    {
+        if (g_strcmp0 (lightdm_layout_get_name (link->data), name) == 0)
+        {
+            lightdm_set_layout (link->data);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static bool
+set_layout_cb (JSContextRef context,
+               JSObjectRef thisObject,
+               JSStringRef propertyName,
+               JSValueRef value,
+               JSValueRef *exception)
+{
+    JSStringRef layout_arg;
+    gchar *layout;
+
+    // FIXME: Throw exception
+    if (JSValueGetType (context, value) != kJSTypeString)
+        return false;
+
+    layout_arg = JSValueToStringCopy (context, value, NULL);
+    layout = toGChar (layout_arg);
+    JSStringRelease (layout_arg);
+
+    /* Switched to once the layouts are known */
+    if (!enumeration_done)
+    {
+        g_free (current_layout);
+        current_layout = layout;
+        layout_pending = TRUE;
+        return true;
+    }
+
+    if (switch_layout (layout))
+    {
+        g_free (current_layout);
+        current_layout = layout;
+    }
+    else
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Unknown keyboard layout %s", layout);
+        g_free (layout);
+    }
+
+    return true;
+}
+
+static JSObjectRef
+make_sessions_array (JSContextRef context)
+{
+    guint i;
+    JSValueRef *args;
+
+    args = g_malloc (sizeof (JSValueRef) * (sessions->len + 1));
+    for (i = 0; i < sessions->len; i++)
+        args[i] = JSObjectMake (context, lightdm_session_class, session_ref (g_ptr_array_index (sessions, i)));
+
+    sessions_array = JSObjectMakeArray (context, sessions->len, args, NULL);
+    JSValueProtect (context, sessions_array);
+    g_free (args);
+    return sessions_array;
+}
+
+static JSValueRef
+get_sessions_cb (JSContextRef context,
+                 JSObjectRef thisObject,
+                 JSStringRef propertyName,
+                 JSValueRef *exception)
+{
+    if (sessions_array != NULL)
+        return sessions_array;
+
+    return make_sessions_array (context);
+}
+
+static JSValueRef
+get_session_table_cb (JSContextRef context,
+                      JSObjectRef thisObject,
+                      JSStringRef propertyName,
+                      JSValueRef *exception)
+{
+    const JsonMember members[] = { SESSION_FIELDS (JSON_STRING_MEMBER) };
+    GString *json;
+    JSValueRef result;
+    guint i;
+
+    json = g_string_new ("[");
+    for (i = 0; i < sessions->len; i++)
+    {
+        json_append_object (json, g_ptr_array_index (sessions, i), members, G_N_ELEMENTS (members));
+        if (i + 1 < sessions->len)
+            g_string_append_c (json, ',');
+    }
+    g_string_append_c (json, ']');
+
+    result = make_json_value (context, json->str);
+    g_string_free (json, TRUE);
+    return result;
+}
+
+static JSValueRef
+get_default_session_cb (JSContextRef context,
+                        JSObjectRef thisObject,
+                        JSStringRef propertyName,
+                        JSValueRef *exception)
+{
+    JSStringRef string;
+
+    string = JSStringCreateWithUTF8CString (backend->get_default_session_hint ());
+
+    return JSValueMakeString (context, string);
+}
+
+static JSValueRef
+get_timed_login_user_cb (JSContextRef context,
+                         JSObjectRef thisObject,
+                         JSStringRef propertyName,
+                         JSValueRef *exception)
+{
+    JSStringRef string;
+
+    string = JSStringCreateWithUTF8CString (backend->get_autologin_user_hint ());
+
+    return JSValueMakeString (context, string);
+}
+
+static JSValueRef
+get_timed_login_delay_cb (JSContextRef context,
+                          JSObjectRef thisObject,
+                          JSStringRef propertyName,
+                          JSValueRef *exception)
+{
+    gint delay;
+
+    delay = backend->get_autologin_timeout_hint ();
+    return JSValueMakeNumber (context, delay);
+}
+static JSValueRef
+cancel_timed_login_cb (JSContextRef context,
+                       JSObjectRef function,
+                       JSObjectRef thisObject,
+                       size_t argumentCount,
+                       const JSValueRef arguments[],
+                       JSValueRef *exception)
+{
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    backend->cancel_autologin ();
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+start_authentication_cb (JSContextRef context,
+                         JSObjectRef function,
+                         JSObjectRef thisObject,
+                         size_t argumentCount,
+                         const JSValueRef arguments[],
+                         JSValueRef *exception)
+{
+    JSStringRef name_arg;
+    char name[1024];
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
+        return JSValueMakeNull (context);
+
+    name_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    JSStringGetUTF8CString (name_arg, name, 1024);
+    JSStringRelease (name_arg);
+
+    /* A conversation the theme walked away from counts as failed */
+    auth_trace_end (FALSE);
+    auth_trace_begin ();
+    watchdog_enter (&scope, G_STRFUNC);
+    if (!claim_prepared_authentication (name))
+        backend->authenticate (name);
+    watchdog_leave (&scope);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+prepare_authentication_cb (JSContextRef context,
+                           JSObjectRef function,
+                           JSObjectRef thisObject,
+                           size_t argumentCount,
+                           const JSValueRef arguments[],
+                           JSValueRef *exception)
+{
+    JSStringRef name_arg;
+    gchar *name;
+
+    // FIXME: Throw exception
+    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
+        return JSValueMakeBoolean (context, FALSE);
+
+    /* Never pull the rug from under a conversation the theme owns */
+    if (!preauthenticate || (prepared_user == NULL && backend->get_in_authentication ()))
+        return JSValueMakeBoolean (context, FALSE);
+
+    name_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    name = toGChar (name_arg);
+    JSStringRelease (name_arg);
+
+    prepare_authentication (name);
+    g_free (name);
+
+    return JSValueMakeBoolean (context, TRUE);
+}
+
+/* users.conf compiled by --compile-users-conf into users.db next to it, for
+ * sites where the keyfile has grown too big to parse on every lookup. The
+ * table is native endian, all guint32:
+ *
+ *   header   magic, version, n_entries, n_buckets, n_slots, the offsets of
+ *            the three sections below, then the size and SHA-1 of the
+ *            users.conf it was compiled from
+ *   seeds    one displacement per bucket, hash and displace, so every
+ *            (user, property) pair lands in a slot of its own
+ *   slots    key offset, key length, value offset, value length, a key
+ *            length of 0 marks a free slot
+ *   strings  "user\0property\0value\0" sorted by user then property
+ */
+#define USERS_DB_MAGIC 0x42444355
+#define USERS_DB_VERSION 2
+#define USERS_DB_DIGEST_SIZE 20
+#define USERS_DB_HEADER_SIZE (9 * sizeof (guint32) + USERS_DB_DIGEST_SIZE)
+#define USERS_DB_MAX_SEED 100000
+
+typedef struct
+{
+    gchar *user;
+    gchar *property;
+    gchar *value;
+    guint32 bucket;
+} UsersDbEntry;
+
+/* Both files are stat()ed on every lookup, the table is mapped again when
+ * users.db changes and users.conf read again when that does. Comparing the
+ * content rather than mtimes survives make install and same second edits. */
+static GMappedFile *users_db = NULL;
+static gchar *users_db_path = NULL;
+static gchar *users_db_filename = NULL;
+static GStatBuf users_db_stat;
+static GStatBuf users_db_conf_stat;
+static gboolean users_db_checked = FALSE;
+static gboolean users_db_conf_checked = FALSE;
+static gboolean users_db_current = FALSE;
+
+static guint32
+users_db_hash (guint32 seed, const gchar *user, const gchar *property)
+{
+    const guchar *c;
+    guint32 h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    /* FNV-1a over "user\0property" */
+    for (c = (const guchar *) user; *c; c++)
+        h = (h ^ *c) * 16777619u;
+    h *= 16777619u;
+    for (c = (const guchar *) property; *c; c++)
+        h = (h ^ *c) * 16777619u;
+
+    /* FNV leaves the low bits poorly mixed, and those pick the slot */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static gint
+users_db_compare_entries (gconstpointer a, gconstpointer b)
+{
+    const UsersDbEntry *ea = *(UsersDbEntry * const *) a;
+    const UsersDbEntry *eb = *(UsersDbEntry * const *) b;
+    gint result = strcmp (ea->user, eb->user);
+
+    return result != 0 ? result : strcmp (ea->property, eb->property);
+}
+
+static gint
+users_db_compare_buckets (gconstpointer a, gconstpointer b)
+{
+    const GPtrArray *ba = *(GPtrArray * const *) a;
+    const GPtrArray *bb = *(GPtrArray * const *) b;
+
+    return (gint) bb->len - (gint) ba->len;
+}
+
+/* Largest buckets first while the table is still empty, a seed for each that
+ * puts all its entries in free slots. FALSE when some bucket has none */
+static gboolean
+users_db_place (GPtrArray *entries, guint32 n_buckets, guint32 n_slots, guint32 *seeds, guint32 *placement)
+{
+    GPtrArray **buckets = g_new0 (GPtrArray *, n_buckets);
+    GPtrArray **order = g_new (GPtrArray *, n_buckets);
+    gboolean *taken = g_new0 (gboolean, n_slots);
+    guint32 *candidate = g_new (guint32, entries->len);
+    gboolean placed = TRUE;
+    guint32 b, i, j;
+
+    for (b = 0; b < n_buckets; b++)
+        order[b] = buckets[b] = g_ptr_array_new ();
+    for (i = 0; i < entries->len; i++)
+    {
+        UsersDbEntry *entry = g_ptr_array_index (entries, i);
+        g_ptr_array_add (buckets[entry->bucket], GUINT_TO_POINTER (i));
+    }
+    qsort (order, n_buckets, sizeof (GPtrArray *), users_db_compare_buckets);
+
+    for (b = 0; placed && b < n_buckets && order[b]->len > 0; b++)
+    {
+        GPtrArray *bucket = order[b];
+        guint32 seed;
+
+        placed = FALSE;
+        for (seed = 1; !placed && seed < USERS_DB_MAX_SEED; seed++)
+        {
+            placed = TRUE;
+            for (i = 0; placed && i < bucket->len; i++)
+            {
+                UsersDbEntry *entry = g_ptr_array_index (entries, GPOINTER_TO_UINT (g_ptr_array_index (bucket, i)));
+
+                candidate[i] = users_db_hash (seed, entry->user, entry->property) % n_slots;
+                if (taken[candidate[i]])
+                    placed = FALSE;
+                for (j = 0; placed && j < i; j++)
+                    if (candidate[j] == candidate[i])
+                        placed = FALSE;
+            }
+        }
+        if (!placed)
+            break;
+
+        seeds[((UsersDbEntry *) g_ptr_array_index (entries, GPOINTER_TO_UINT (g_ptr_array_index (bucket, 0))))->bucket] = seed - 1;
+        for (i = 0; i < bucket->len; i++)
+        {
+            taken[candidate[i]] = TRUE;
+            placement[GPOINTER_TO_UINT (g_ptr_array_index (bucket, i))] = candidate[i];
+        }
+    }
+
+    for (b = 0; b < n_buckets; b++)
+        g_ptr_array_free (buckets[b], TRUE);
+    g_free (buckets);
+    g_free (order);
+    g_free (taken);
+    g_free (candidate);
+
+    return placed;
+}
+
+static void
+users_db_entry_free (gpointer data)
+{
+    UsersDbEntry *entry = data;
+
+    g_free (entry->user);
+    g_free (entry->property);
+    g_free (entry->value);
+    g_free (entry);
+}
+
+static gboolean
+compile_users_conf (const gchar *filename, GError **error)
+{
+    GKeyFile *keyfile;
+    GPtrArray *entries;
+    GString *strings;
+    GString *table;
+    GChecksum *checksum;
+    gchar **groups, *db_filename, *dir, *contents;
+    guint32 header[9], *seeds, *placement, *slots;
+    guint8 digest[USERS_DB_DIGEST_SIZE];
+    gsize length, digest_length = USERS_DB_DIGEST_SIZE;
+    guint32 n_buckets, n_slots, i;
+    gboolean result;
+
+    if (!g_file_get_contents (filename, &contents, &length, error))
+        return FALSE;
+
+    /* users_db_open tells a stale table by this */
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+    g_checksum_update (checksum, (const guchar *) contents, length);
+    g_checksum_get_digest (checksum, digest, &digest_length);
+    g_checksum_free (checksum);
+
+    keyfile = g_key_file_new ();
+    result = g_key_file_load_from_data (keyfile, contents, length, G_KEY_FILE_NONE, error);
+    g_free (contents);
+    if (!result)
+    {
+        g_key_file_free (keyfile);
+        return FALSE;
+    }
+
+    /* Values go through g_key_file_get_string, as the lookup always did */
+    entries = g_ptr_array_new_with_free_func (users_db_entry_free);
+    groups = g_key_file_get_groups (keyfile, NULL);
+    for (i = 0; groups[i]; i++)
+    {
+        gchar **keys = g_key_file_get_keys (keyfile, groups[i], NULL, NULL);
+        gint k;
+
+        for (k = 0; keys && keys[k]; k++)
+        {
+            UsersDbEntry *entry = g_new0 (UsersDbEntry, 1);
+
+            entry->user = g_strdup (groups[i]);
+            entry->property = g_strdup (keys[k]);
+            entry->value = g_key_file_get_string (keyfile, groups[i], keys[k], NULL);
+            if (entry->value == NULL)
+                entry->value = g_strdup ("");
+            g_ptr_array_add (entries, entry);
+        }
+        g_strfreev (keys);
+    }
+    g_strfreev (groups);
+    g_key_file_free (keyfile);
+    g_ptr_array_sort (entries, users_db_compare_entries);
+
+    /* Roughly four keys a bucket, a quarter of the slots free; grow the table
+     * in the unlikely case some bucket finds no seed */
+    n_buckets = entries->len / 4 + 1;
+    n_slots = entries->len + entries->len / 4 + 1;
+    seeds = g_new0 (guint32, n_buckets);
+    placement = g_new0 (guint32, entries->len);
+    for (i = 0; i < entries->len; i++)
+    {
+        UsersDbEntry *entry = g_ptr_array_index (entries, i);
+        entry->bucket = users_db_hash (0, entry->user, entry->property) % n_buckets;
+    }
+    while (!users_db_place (entries, n_buckets, n_slots, seeds, placement))
+    {
+        n_slots += n_slots / 2;
+        memset (seeds, 0, n_buckets * sizeof (guint32));
+    }
+
+    slots = g_new0 (guint32, n_slots * 4);
+    strings = g_string_new (NULL);
+    for (i = 0; i < entries->len; i++)
+    {
+        UsersDbEntry *entry = g_ptr_array_index (entries, i);
+        guint32 *slot = slots + placement[i] * 4;
+
+        slot[0] = strings->len;
+        g_string_append (strings, entry->user);
+        g_string_append_c (strings, '\0');
+        g_string_append (strings, entry->property);
+        slot[1] = strings->len - slot[0];
+        g_string_append_c (strings, '\0');
+        slot[2] = strings->len;
+        g_string_append (strings, entry->value);
+        slot[3] = strings->len - slot[2];
+        g_string_append_c (strings, '\0');
+    }
+
+    header[0] = USERS_DB_MAGIC;
+    header[1] = USERS_DB_VERSION;
+    header[2] = entries->len;
+    header[3] = n_buckets;
+    header[4] = n_slots;
+    header[5] = USERS_DB_HEADER_SIZE;
+    header[6] = header[5] + n_buckets * sizeof (guint32);
+    header[7] = header[6] + n_slots * 4 * sizeof (guint32);
+    header[8] = length;
+
+    /* String offsets are relative to the strings section */
+    table = g_string_sized_new (header[7] + strings->len);
+    g_string_append_len (table, (const gchar *) header, sizeof (header));
+    g_string_append_len (table, (const gchar *) digest, USERS_DB_DIGEST_SIZE);
+    g_string_append_len (table, (const gchar *) seeds, n_buckets * sizeof (guint32));
+    g_string_append_len (table, (const gchar *) slots, n_slots * 4 * sizeof (guint32));
+    g_string_append_len (table, strings->str, strings->len);
+
+    dir = g_path_get_dirname (filename);
+    db_filename = g_build_filename (dir, "users.db", NULL);
+    result = g_file_set_contents (db_filename, table->str, table->len, error);
+    if (result)
+        g_print ("%s: %u entries in %u slots\n", db_filename, entries->len, n_slots);
+
+    g_free (dir);
+    g_free (db_filename);
+    g_string_free (table, TRUE);
+    g_string_free (strings, TRUE);
+    g_free (slots);
+    g_free (seeds);
+    g_free (placement);
+    g_ptr_array_free (entries, TRUE);
+
+    return result;
+}
+
+static guint32
+users_db_read (const gchar *data, gsize offset)
+{
+    guint32 value;
+
+    memcpy (&value, data + offset, sizeof (value));
+    return value;
+}
+
+static gboolean
+same_file_stat (const GStatBuf *a, const GStatBuf *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+/* Reads users.conf through once, no parsing, and compares it with what the
+ * table was compiled from */
+static gboolean
+users_db_matches_conf (GMappedFile *file, const gchar *userConfFilename)
+{
+    const gchar *data = g_mapped_file_get_contents (file);
+    GChecksum *checksum;
+    gchar *contents;
+    guint8 digest[USERS_DB_DIGEST_SIZE];
+    gsize length, digest_length = USERS_DB_DIGEST_SIZE;
+
+    if (!g_file_get_contents (userConfFilename, &contents, &length, NULL))
+        return FALSE;
+    if (length != users_db_read (data, 32))
+    {
+        g_free (contents);
+        return FALSE;
+    }
+
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+    g_checksum_update (checksum, (const guchar *) contents, length);
+    g_checksum_get_digest (checksum, digest, &digest_length);
+    g_checksum_free (checksum);
+    g_free (contents);
+
+    return memcmp (digest, data + 36, USERS_DB_DIGEST_SIZE) == 0;
+}
+
+static GMappedFile *
+users_db_map (const gchar *db_filename)
+{
+    GMappedFile *file;
+    const gchar *data;
+    gsize length;
+
+    file = g_mapped_file_new (db_filename, FALSE, NULL);
+    if (file == NULL)
+        return NULL;
+
+    data = g_mapped_file_get_contents (file);
+    length = g_mapped_file_get_length (file);
+    if (length < USERS_DB_HEADER_SIZE
+        || users_db_read (data, 0) != USERS_DB_MAGIC
+        || users_db_read (data, 4) != USERS_DB_VERSION
+        || users_db_read (data, 12) == 0 || users_db_read (data, 16) == 0)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Not a compiled users.conf: %s", db_filename);
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    if ((guint64) users_db_read (data, 20) + users_db_read (data, 12) * sizeof (guint32) > length
+        || (guint64) users_db_read (data, 24) + (guint64) users_db_read (data, 16) * 4 * sizeof (guint32) > length
+        || users_db_read (data, 28) > length)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Truncated compiled users.conf: %s", db_filename);
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/* The compiled table for a users.conf, NULL to parse the keyfile instead */
+static GMappedFile *
+users_db_open (const gchar *userConfFilename)
+{
+    GStatBuf db_stat, conf_stat;
+
+    if (g_strcmp0 (users_db_path, userConfFilename) != 0)
+    {
+        gchar *dir = g_path_get_dirname (userConfFilename);
+
+        g_free (users_db_path);
+        g_free (users_db_filename);
+        users_db_path = g_strdup (userConfFilename);
+        users_db_filename = g_build_filename (dir, "users.db", NULL);
+        g_free (dir);
+        if (users_db != NULL)
+            g_mapped_file_unref (users_db);
+        users_db = NULL;
+        users_db_checked = users_db_conf_checked = FALSE;
+    }
+
+    if (g_stat (users_db_filename, &db_stat) != 0)
+    {
+        if (users_db != NULL)
+            g_mapped_file_unref (users_db);
+        users_db = NULL;
+        users_db_checked = FALSE;
+        return NULL;
+    }
+
+    /* Recompiled, or replaced by something else entirely */
+    if (!users_db_checked || !same_file_stat (&db_stat, &users_db_stat))
+    {
+        if (users_db != NULL)
+            g_mapped_file_unref (users_db);
+        users_db = users_db_map (users_db_filename);
+        users_db_stat = db_stat;
+        users_db_checked = TRUE;
+        users_db_conf_checked = FALSE;
+    }
+    if (users_db == NULL)
+        return NULL;
+
+    /* A site may ship the table alone */
+    if (g_stat (userConfFilename, &conf_stat) != 0)
+        return users_db;
+
+    if (!users_db_conf_checked || !same_file_stat (&conf_stat, &users_db_conf_stat))
+    {
+        users_db_current = users_db_matches_conf (users_db, userConfFilename);
+        if (!users_db_current)
+            logMessage(G_LOG_LEVEL_MESSAGE, "Ignoring %s, users.conf changed since, run --compile-users-conf again", users_db_filename);
+        users_db_conf_stat = conf_stat;
+        users_db_conf_checked = TRUE;
+    }
+
+    return users_db_current ? users_db : NULL;
+}
+
+/* Straight off the mapping, NULL when the pair is not in the table */
+static const gchar *
+users_db_lookup (GMappedFile *file, const gchar *user, const gchar *property)
+{
+    const gchar *data = g_mapped_file_get_contents (file);
+    gsize length = g_mapped_file_get_length (file);
+    guint32 n_buckets = users_db_read (data, 12);
+    guint32 n_slots = users_db_read (data, 16);
+    guint32 seeds = users_db_read (data, 20);
+    guint32 slots = users_db_read (data, 24);
+    guint32 strings = users_db_read (data, 28);
+    guint32 bucket, seed, slot, key_offset, key_length, value_offset, value_length;
+    gsize user_length;
+
+    bucket = users_db_hash (0, user, property) % n_buckets;
+    seed = users_db_read (data, seeds + bucket * sizeof (guint32));
+    slot = slots + (users_db_hash (seed, user, property) % n_slots) * 4 * sizeof (guint32);
+
+    key_offset = users_db_read (data, slot);
+    key_length = users_db_read (data, slot + 4);
+    value_offset = users_db_read (data, slot + 8);
+    value_length = users_db_read (data, slot + 12);
+    if (key_length == 0
+        || (guint64) strings + key_offset + key_length >= length
+        || (guint64) strings + value_offset + value_length >= length
+        || data[strings + value_offset + value_length] != '\0')
+        return NULL;
+
+    /* Every key hashes to some slot, make sure it is this one */
+    user_length = strlen (user);
+    if (user_length + 1 + strlen (property) != key_length
+        || memcmp (data + strings + key_offset, user, user_length + 1) != 0
+        || memcmp (data + strings + key_offset + user_length + 1, property, key_length - user_length - 1) != 0)
+        return NULL;
+
+    return data + strings + value_offset;
+}
+
+static JSValueRef
+getJSValueRefFromPropFile(JSContextRef context,
+                           gchar *gUsr,
+                           gchar *gProperty,
+                           gchar* userConfFilename
+                           )
+{
+    //Later we will get this from file.
+    //GKeyFile *keyfile;
+    GKeyFile *keyfile;
+    GError *err = NULL;
+    GMappedFile *db = users_db_open (userConfFilename);
+
+    if (db != NULL) {
+      const gchar *value = users_db_lookup (db, gUsr, gProperty);
+      if (value == NULL) {
+        g_message("No %s for %s in the compiled users.conf", gProperty, gUsr);
+        return JSValueMakeNull (context);
+      }
+
+      JSStringRef result = JSStringCreateWithUTF8CString (value);
+      JSValueRef ret = JSValueMakeString (context, result);
+      JSStringRelease (result);
+      return ret;
+    }
+
+    keyfile = g_key_file_new ();
+
+    gboolean fileFound = g_key_file_load_from_file (keyfile, userConfFilename, G_KEY_FILE_NONE, &err);
+
+    if (fileFound == FALSE) {
+      g_message("Error attempting g_key_file_load_from_file: %s", err->message);
+      g_error_free (err);
+      return JSValueMakeNull (context);
+    }
+
+    //Query the keyfile for property.
+
+    gchar *gResult = g_key_file_get_string(keyfile, gUsr, gProperty, &err);
+    if (gResult == NULL) {
+      g_message("Error attempting g_key_file_get_string: %s", err->message);
+      g_error_free (err);
+      return JSValueMakeNull (context);
+    }
+
+    //Free keyfile
+    g_key_file_free(keyfile);
+
+    //Free keyfile
+    JSStringRef result = JSStringCreateWithUTF8CString (gResult);
+    g_free(gResult);
+    JSValueRef ret = JSValueMakeString (context, result);
+    JSStringRelease (result);
+
+
+    return ret;
+}
+
+
+static JSValueRef
+getCustomProperty_cb (JSContextRef context,
+                            JSObjectRef function,
+                            JSObjectRef thisObject,
+                            size_t argumentCount,
+                            const JSValueRef arguments[],
+                            JSValueRef *exception)
+{
+    JSStringRef user_arg, prop_arg;
+
+    if (argumentCount != 2) {
+      gchar* retmessage = g_strdup_printf("Wrong argument count on call to getCustomProperty_cb. Should be 2, but was: %zu", argumentCount);
+      g_message(retmessage);
+      g_free(retmessage);
+      return JSValueMakeNull (context);
+    }
+
+
+
+    user_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    prop_arg = JSValueToStringCopy (context, arguments[1], NULL);
+
+    if (user_arg == NULL | prop_arg == NULL) {
+      g_message("Error on call to getCustomProperty_cb. Arguments were NULL.");
+      return JSValueMakeNull (context);
+    }
+    //convert strings to a *gchar so we can use it to query the prop file.
+    gchar *gUsr = toGChar(user_arg);
+    gchar *gProperty = toGChar(prop_arg) ;
+
+    //After we are done using, release the strings.
+    JSStringRelease (user_arg);
+    JSStringRelease (prop_arg);
+
+    gchar* userConfFilename = g_build_filename(theme_dir, "users.conf", NULL);
+
+
+    WatchdogScope scope;
+    watchdog_enter (&scope, G_STRFUNC);
+    JSValueRef ret = getJSValueRefFromPropFile(context, gUsr, gProperty, userConfFilename);
+    watchdog_leave (&scope);
+    g_free(userConfFilename);
+    g_free(gUsr);
+    g_free(gProperty);
+    return ret;
+}
+
+
+
+
+static JSValueRef
+provide_secret_cb (JSContextRef context,
+                   JSObjectRef function,
+                   JSObjectRef thisObject,
+                   size_t argumentCount,
+                   const JSValueRef arguments[],
+                   JSValueRef *exception)
+{
+    JSStringRef secret_arg;
+    char secret[1024];
+
+    // FIXME: Throw exception
+    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
+        return JSValueMakeNull (context);
+
+    secret_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    JSStringGetUTF8CString (secret_arg, secret, 1024);
+    JSStringRelease (secret_arg);
+
+    auth_trace.responded = g_get_monotonic_time ();
+    backend->respond (secret);
+
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+cancel_authentication_cb (JSContextRef context,
+                          JSObjectRef function,
+                          JSObjectRef thisObject,
+                          size_t argumentCount,
+                          const JSValueRef arguments[],
+                          JSValueRef *exception)
+{
+
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    clear_prepared_authentication ();
+    backend->cancel_authentication ();
+    /* Or the next attempt's timings start from this one */
+    auth_trace_end (FALSE);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+get_authentication_user_cb (JSContextRef context,
+                            JSObjectRef thisObject,
+                            JSStringRef propertyName,
+                            JSValueRef *exception)
+{
+    return JSValueMakeString (context, JSStringCreateWithUTF8CString (backend->get_authentication_user ()));
+}
+
+static JSValueRef
+get_is_authenticated_cb (JSContextRef context,
+                         JSObjectRef thisObject,
+                         JSStringRef propertyName,
+                         JSValueRef *exception)
+{
+    return JSValueMakeBoolean (context, backend->get_is_authenticated ());
+}
+
+static JSValueRef
+get_can_suspend_cb (JSContextRef context,
+                    JSObjectRef thisObject,
+                    JSStringRef propertyName,
+                    JSValueRef *exception)
+{
+    WatchdogScope scope;
+    gboolean can;
+
+    watchdog_enter (&scope, G_STRFUNC);
+    can = backend->get_can_suspend ();
+    watchdog_leave (&scope);
+    return JSValueMakeBoolean (context, can);
+}
+
+static JSValueRef
+suspend_cb (JSContextRef context,
+            JSObjectRef function,
+            JSObjectRef thisObject,
+            size_t argumentCount,
+            const JSValueRef arguments[],
+            JSValueRef *exception)
+{
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    watchdog_enter (&scope, G_STRFUNC);
+    backend->suspend (NULL);
+    watchdog_leave (&scope);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+get_can_hibernate_cb (JSContextRef context,
+                      JSObjectRef thisObject,
+                      JSStringRef propertyName,
+                      JSValueRef *exception)
+{
+    WatchdogScope scope;
+    gboolean can;
+
+    watchdog_enter (&scope, G_STRFUNC);
+    can = backend->get_can_hibernate ();
+    watchdog_leave (&scope);
+    return JSValueMakeBoolean (context, can);
+}
+
+static JSValueRef
+hibernate_cb (JSContextRef context,
+              JSObjectRef function,
+              JSObjectRef thisObject,
+              size_t argumentCount,
+              const JSValueRef arguments[],
+              JSValueRef *exception)
+{
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    watchdog_enter (&scope, G_STRFUNC);
+    backend->hibernate (NULL);
+    watchdog_leave (&scope);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+get_can_restart_cb (JSContextRef context,
+                    JSObjectRef thisObject,
+                    JSStringRef propertyName,
+                    JSValueRef *exception)
+{
+    WatchdogScope scope;
+    gboolean can;
+
+    watchdog_enter (&scope, G_STRFUNC);
+    can = backend->get_can_restart ();
+    watchdog_leave (&scope);
+    return JSValueMakeBoolean (context, can);
+}
+
+static JSValueRef
+restart_cb (JSContextRef context,
+            JSObjectRef function,
+            JSObjectRef thisObject,
+            size_t argumentCount,
+            const JSValueRef arguments[],
+            JSValueRef *exception)
+{
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    watchdog_enter (&scope, G_STRFUNC);
+    backend->restart (NULL);
+    watchdog_leave (&scope);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+get_can_shutdown_cb (JSContextRef context,
+                     JSObjectRef thisObject,
+                     JSStringRef propertyName,
+                     JSValueRef *exception)
+{
+    WatchdogScope scope;
+    gboolean can;
+
+    watchdog_enter (&scope, G_STRFUNC);
+    can = backend->get_can_shutdown ();
+    watchdog_leave (&scope);
+    return JSValueMakeBoolean (context, can);
+}
+
+static JSValueRef
+shutdown_cb (JSContextRef context,
+             JSObjectRef function,
+             JSObjectRef thisObject,
+             size_t argumentCount,
+             const JSValueRef arguments[],
+             JSValueRef *exception)
+{
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+    if (argumentCount != 0)
+        return JSValueMakeNull (context);
+
+    watchdog_enter (&scope, G_STRFUNC);
+    backend->shutdown (NULL);
+    watchdog_leave (&scope);
+    return JSValueMakeNull (context);
+}
+
+static JSValueRef
+login_cb (JSContextRef context,
+          JSObjectRef function,
+          JSObjectRef thisObject,
+          size_t argumentCount,
+          const JSValueRef arguments[],
+          JSValueRef *exception)
+{
+    JSStringRef arg;
+    char username[1024], *session = NULL, *language = NULL;
+    gboolean started;
+    WatchdogScope scope;
+
+    // FIXME: Throw exception
+
+    arg = JSValueToStringCopy (context, arguments[0], NULL);
+    JSStringGetUTF8CString (arg, username, 1024);
+    JSStringRelease (arg);
+
+    if (argumentCount > 1)
+    {
+        arg = JSValueToStringCopy (context, arguments[1], NULL);
+        session = g_malloc (sizeof (char) * 1024);
+        JSStringGetUTF8CString (arg, session, 1024);
+        JSStringRelease (arg);
+    }
+
+    if (argumentCount > 2 && JSValueGetType (context, arguments[2]) == kJSTypeString)
+    {
+        arg = JSValueToStringCopy (context, arguments[2], NULL);
+        language = toGChar (arg);
+        JSStringRelease (arg);
+    }
+    else if (current_language != NULL)
+        language = g_strdup (current_language);
+
+    if (language != NULL)
+        backend->set_language (language);
+
+    auth_trace.login_requested = g_get_monotonic_time ();
+    watchdog_enter (&scope, G_STRFUNC);
+    started = backend->start_session (session, NULL);
+    watchdog_leave (&scope);
+    auth_trace.session_started = g_get_monotonic_time ();
+    if (started && benchmark_theme == NULL)
+    {
+        last_state_save (username, session, language);
+        /* The daemon waits for us to go before handing over the display */
+        quit_cb (NULL, username);
+    }
+    if (started && benchmark_theme != NULL)
+    {
+        benchmark.session_started = auth_trace.session_started;
+        benchmark_finish ();
+    }
+    auth_trace_end (started);
+    g_free (session);
+    g_free (language);
+
+    return JSValueMakeNull (context);
+}
+
+/* GNU .mo files, see "The Format of GNU MO Files" in the gettext manual */
+#define MO_MAGIC 0x950412de
+#define MO_MAGIC_SWAPPED 0xde120495
+
+typedef struct
+{
+    const gchar *translation;
+    guint32 length;
+} MoEntry;
+
+/* Strings point straight into the mapped .mo file, nothing is copied */
+typedef struct
+{
+    GMappedFile *file;
+    MoEntry *entries;
+    GHashTable *messages;
+    gchar *plural;
+    gulong nplurals;
+} Catalog;
+
+/* "language/domain" -> Catalog, language is empty for the startup locale */
+static GHashTable *catalogs = NULL;
+
+/* Languages preloaded off the main thread, from the languages key */
+static gchar **preload_languages = NULL;
+
+/* Msgid -> translated JSStringRef, saves the libc lookup and the UTF-8 to
+ * UTF-16 conversion of the result for strings translated over and over. */
+static GHashTable *gettext_cache = NULL;
+
+static void
+catalog_free (Catalog *catalog)
+{
+    g_hash_table_destroy (catalog->messages);
+    g_free (catalog->entries);
+    g_free (catalog->plural);
+    g_mapped_file_unref (catalog->file);
+    g_free (catalog);
+}
+
+static guint32
+mo_read_uint32 (const gchar *data, gsize offset, gboolean swapped)
+{
+    guint32 value;
+
+    memcpy (&value, data + offset, sizeof (value));
+    return swapped ? GUINT32_SWAP_LE_BE (value) : value;
+}
+
+/* Evaluates the C subset used by Plural-Forms expressions */
+static gulong plural_parse_ternary (const gchar **expression, gulong n);
+
+static void
+plural_skip_space (const gchar **expression)
+{
+    while (g_ascii_isspace (**expression))
+        (*expression)++;
+}
+
+static gboolean
+plural_accept (const gchar **expression, const gchar *token)
+{
+    plural_skip_space (expression);
+    if (!g_str_has_prefix (*expression, token))
+        return FALSE;
+
+    /* Do not take the "<" of "<=" or the "!" of "!=" */
+    if (strlen (token) == 1 && (token[0] == '<' || token[0] == '>' || token[0] == '!' || token[0] == '=') && (*expression)[1] == '=')
+        return FALSE;
+
+    *expression += strlen (token);
+    return TRUE;
+}
+
+static gulong
+plural_parse_primary (const gchar **expression, gulong n)
+{
+    gulong value;
+
+    if (plural_accept (expression, "!"))
+        return !plural_parse_primary (expression, n);
+    if (plural_accept (expression, "("))
+    {
+        value = plural_parse_ternary (expression, n);
+        plural_accept (expression, ")");
+        return value;
+    }
+    if (plural_accept (expression, "n"))
+        return n;
+
+    plural_skip_space (expression);
+    return strtoul (*expression, (gchar **) expression, 10);
+}
+
+static gulong
+plural_parse_binary (const gchar **expression, gulong n, gint level)
+{
+    static const gchar *operators[][4] =
+    {
+        { "||", NULL },
+        { "&&", NULL },
+        { "==", "!=", NULL },
+        { "<=", ">=", "<", ">" },
+        { "+", "-", NULL },
+        { "*", "/", "%", NULL },
+    };
+    gulong value, rhs;
+    gboolean matched;
+    gint i;
+
+    if (level == G_N_ELEMENTS (operators))
+        return plural_parse_primary (expression, n);
+
+    value = plural_parse_binary (expression, n, level + 1);
+    do
+    {
+        matched = FALSE;
+        for (i = 0; i < 4 && operators[level][i] && !matched; i++)
+        {
+            const gchar *op = operators[level][i];
+
+            if (!plural_accept (expression, op))
+                continue;
+            matched = TRUE;
+            rhs = plural_parse_binary (expression, n, level + 1);
+            if (strcmp (op, "||") == 0) value = value || rhs;
+            else if (strcmp (op, "&&") == 0) value = value && rhs;
+            else if (strcmp (op, "==") == 0) value = value == rhs;
+            else if (strcmp (op, "!=") == 0) value = value != rhs;
+            else if (strcmp (op, "<=") == 0) value = value <= rhs;
+            else if (strcmp (op, ">=") == 0) value = value >= rhs;
+            else if (strcmp (op, "<") == 0) value = value < rhs;
+            else if (strcmp (op, ">") == 0) value = value > rhs;
+            else if (strcmp (op, "+") == 0) value = value + rhs;
+            else if (strcmp (op, "-") == 0) value = value - rhs;
+            else if (strcmp (op, "*") == 0) value = value * rhs;
+            else if (strcmp (op, "/") == 0) value = rhs ? value / rhs : 0;
+            else if (strcmp (op, "%") == 0) value = rhs ? value % rhs : 0;
+        }
+    } while (matched);
+
+    return value;
+}
+
+static gulong
+plural_parse_ternary (const gchar **expression, gulong n)
+{
+    gulong condition, if_true, if_false;
+
+    condition = plural_parse_binary (expression, n, 0);
+    if (!plural_accept (expression, "?"))
+        return condition;
+
+    if_true = plural_parse_ternary (expression, n);
+    plural_accept (expression, ":");
+    if_false = plural_parse_ternary (expression, n);
+
+    return condition ? if_true : if_false;
+}
+
+static gulong
+catalog_get_plural_index (Catalog *catalog, gulong n)
+{
+    const gchar *expression = catalog->plural;
+    gulong index;
+
+    if (expression == NULL)
+        return n == 1 ? 0 : 1;
+
+    index = plural_parse_ternary (&expression, n);
+    return index < catalog->nplurals ? index : 0;
+}
+
+/* Picks "nplurals=3; plural=(n==1 ? 0 : ...);" out of the .mo header */
+static void
+catalog_parse_header (Catalog *catalog, const gchar *header)
+{
+    const gchar *forms, *plural, *end;
+
+    forms = strstr (header, "Plural-Forms:");
+    if (forms == NULL)
+        return;
+
+    end = strchr (forms, '\n');
+    if (end == NULL)
+        end = forms + strlen (forms);
+
+    plural = g_strstr_len (forms, end - forms, "nplurals=");
+    if (plural != NULL)
+        catalog->nplurals = strtoul (plural + strlen ("nplurals="), NULL, 10);
+
+    plural = g_strstr_len (forms, end - forms, "plural=");
+    /* Do not match the "plural=" inside "nplurals=" */
+    while (plural != NULL && plural > forms && plural[-1] == 'n')
+        plural = g_strstr_len (plural + 1, end - plural - 1, "plural=");
+    if (plural != NULL && catalog->nplurals > 0)
+    {
+        plural += strlen ("plural=");
+        catalog->plural = g_strndup (plural, end - plural);
+        g_strdelimit (catalog->plural, ";", '\0');
+    }
+}
+
+static Catalog *
+catalog_load (const gchar *filename)
+{
+    GMappedFile *file;
+    Catalog *catalog;
+    const gchar *data;
+    gsize length;
+    guint32 magic, n_strings, originals, translations, i;
+    gboolean swapped;
+
+    file = g_mapped_file_new (filename, FALSE, NULL);
+    if (file == NULL)
+        return NULL;
+
+    data = g_mapped_file_get_contents (file);
+    length = g_mapped_file_get_length (file);
+    if (length < 20)
+    {
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    memcpy (&magic, data, sizeof (magic));
+    if (magic != MO_MAGIC && magic != MO_MAGIC_SWAPPED)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Not a gettext catalog: %s", filename);
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+    swapped = magic == MO_MAGIC_SWAPPED;
+    n_strings = mo_read_uint32 (data, 8, swapped);
+    originals = mo_read_uint32 (data, 12, swapped);
+    translations = mo_read_uint32 (data, 16, swapped);
+    /* In 64 bits, a crafted count must not wrap the check and size the table */
+    if ((guint64) originals + (guint64) n_strings * 8 > length || (guint64) translations + (guint64) n_strings * 8 > length)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Truncated gettext catalog: %s", filename);
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    catalog = g_new0 (Catalog, 1);
+    catalog->file = file;
+    catalog->entries = g_new0 (MoEntry, n_strings);
+    catalog->messages = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < n_strings; i++)
+    {
+        guint32 id_length = mo_read_uint32 (data, (gsize) originals + (gsize) i * 8, swapped);
+        guint32 id_offset = mo_read_uint32 (data, (gsize) originals + (gsize) i * 8 + 4, swapped);
+        guint32 str_length = mo_read_uint32 (data, (gsize) translations + (gsize) i * 8, swapped);
+        guint32 str_offset = mo_read_uint32 (data, (gsize) translations + (gsize) i * 8 + 4, swapped);
+
+        /* Skip anything pointing outside the file, or not ending where it
+         * says, both are used as C strings */
+        if ((guint64) id_offset + id_length >= length || (guint64) str_offset + str_length >= length)
+            continue;
+        if (data[(gsize) id_offset + id_length] != '\0' || data[(gsize) str_offset + str_length] != '\0')
+            continue;
+
+        /* The header entry carries the plural rule */
+        if (id_length == 0)
+        {
+            catalog_parse_header (catalog, data + str_offset);
+            continue;
+        }
+
+        catalog->entries[i].translation = data + str_offset;
+        catalog->entries[i].length = str_length;
+        g_hash_table_insert (catalog->messages, (gpointer) (data + id_offset), &catalog->entries[i]);
+    }
+
+    return catalog;
+}
+
+static Catalog *
+catalog_load_for_language (const gchar *language, const gchar *domain)
+{
+    const gchar * const *languages;
+    const gchar *locale_dir;
+    gchar **variants = NULL;
+    Catalog *catalog = NULL;
+    gint i;
+
+    /* pt_BR.UTF-8 also looks in pt_BR and pt */
+    if (language != NULL)
+        languages = (const gchar * const *) (variants = g_get_locale_variants (language));
+    else
+        languages = g_get_language_names ();
+
+    locale_dir = bindtextdomain (domain, NULL);
+    for (i = 0; catalog == NULL && languages[i]; i++)
+    {
+        gchar *filename = g_strdup_printf ("%s/%s/LC_MESSAGES/%s.mo", locale_dir, languages[i], domain);
+        catalog = catalog_load (filename);
+        g_free (filename);
+    }
+    g_strfreev (variants);
+
+    return catalog;
+}
+
+static Catalog *
+get_catalog (const gchar *language, const gchar *domain)
+{
+    Catalog *catalog = NULL;
+    gchar *key;
+
+    if (catalogs == NULL)
+        catalogs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) catalog_free);
+
+    key = g_strdup_printf ("%s/%s", language ? language : "", domain);
+    if (g_hash_table_lookup_extended (catalogs, key, NULL, (gpointer *) &catalog))
+    {
+        g_free (key);
+        return catalog;
+    }
+
+    /* Not preloaded (yet), load it here rather than fail the switch */
+    catalog = catalog_load_for_language (language, domain);
+
+    /* Remember misses too, "C" has no catalog and that must stay cheap */
+    g_hash_table_insert (catalogs, key, catalog);
+    return catalog;
+}
+
+typedef struct
+{
+    gchar **languages;
+    gchar *domain;
+    GHashTable *loaded;
+} PreloadCatalogs;
+
+static gboolean
+preload_catalogs_done_cb (gpointer data)
+{
+    PreloadCatalogs *preload = data;
+    GHashTableIter iter;
+    gpointer key, catalog;
+
+    if (catalogs == NULL)
+        catalogs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) catalog_free);
+
+    /* Anything the main thread loaded meanwhile wins, ours is dropped */
+    g_hash_table_iter_init (&iter, preload->loaded);
+    while (g_hash_table_iter_next (&iter, &key, &catalog))
+    {
+        if (g_hash_table_contains (catalogs, key))
+        {
+            if (catalog != NULL)
+                catalog_free (catalog);
+            g_free (key);
+        }
+        else
+            g_hash_table_insert (catalogs, key, catalog);
+    }
+    g_hash_table_steal_all (preload->loaded);
+    g_hash_table_destroy (preload->loaded);
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Preloaded translations for %u languages", g_strv_length (preload->languages));
+    g_strfreev (preload->languages);
+    g_free (preload->domain);
+    g_free (preload);
+
+    return FALSE;
+}
+
+static gpointer
+preload_catalogs_thread (gpointer data)
+{
+    PreloadCatalogs *preload = data;
+    gint i;
+
+    for (i = 0; preload->languages[i]; i++)
+    {
+        Catalog *catalog = catalog_load_for_language (preload->languages[i], preload->domain);
+
+        g_hash_table_insert (preload->loaded, g_strdup_printf ("%s/%s", preload->languages[i], preload->domain), catalog);
+    }
+    g_idle_add (preload_catalogs_done_cb, preload);
+
+    return NULL;
+}
+
+static void
+preload_catalogs (void)
+{
+    PreloadCatalogs *preload;
+
+    if (preload_languages == NULL || preload_languages[0] == NULL)
+        return;
+
+    preload = g_new0 (PreloadCatalogs, 1);
+    preload->languages = g_strdupv (preload_languages);
+    preload->domain = g_strdup (textdomain (NULL));
+    preload->loaded = g_hash_table_new (g_str_hash, g_str_equal);
+    g_thread_unref (g_thread_new ("preload-catalogs", preload_catalogs_thread, preload));
+}
+
+static const gchar *
+translate (const gchar *msgid, const gchar *msgid_plural, gulong n)
+{
+    Catalog *catalog;
+    MoEntry *entry;
+    const gchar *form;
+    gulong index;
+
+    if (current_language == NULL)
+        return msgid_plural ? ngettext (msgid, msgid_plural, n) : gettext (msgid);
+
+    catalog = get_catalog (current_language, textdomain (NULL));
+    entry = catalog ? g_hash_table_lookup (catalog->messages, msgid) : NULL;
+    if (entry == NULL || entry->length == 0)
+        return msgid_plural && n != 1 ? msgid_plural : msgid;
+    if (msgid_plural == NULL)
+        return entry->translation;
+
+    /* Walk to the n-th of the NUL separated plural forms */
+    form = entry->translation;
+    for (index = catalog_get_plural_index (catalog, n); index > 0; index--)
+    {
+        form += strlen (form) + 1;
+        if (form >= entry->translation + entry->length)
+            return entry->translation;
+    }
+
+    return form;
+}
+
+static JSValueRef
+get_language_cb (JSContextRef context,
+                 JSObjectRef thisObject,
+                 JSStringRef propertyName,
+                 JSValueRef *exception)
+{
+    JSStringRef string;
+    JSValueRef value;
+
+    if (current_language == NULL)
+        return JSValueMakeNull (context);
+
+    string = JSStringCreateWithUTF8CString (current_language);
+    value = JSValueMakeString (context, string);
+    JSStringRelease (string);
+
+    return value;
+}
+
+static JSValueRef
+set_language_cb (JSContextRef context,
+                 JSObjectRef function,
+                 JSObjectRef thisObject,
+                 size_t argumentCount,
+                 const JSValueRef arguments[],
+                 JSValueRef *exception)
+{
+    JSStringRef language_arg;
+    gchar *language;
+
+    // FIXME: Throw exception
+    if (!(argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString))
+        return JSValueMakeBoolean (context, FALSE);
+
+    language_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    language = toGChar (language_arg);
+    JSStringRelease (language_arg);
+
+    g_free (current_language);
+    current_language = language;
+
+    /* Cached strings are in the old language */
+    if (gettext_cache != NULL)
+        g_hash_table_remove_all (gettext_cache);
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Switched greeter language to %s", current_language);
+
+    return JSValueMakeBoolean (context, get_catalog (current_language, textdomain (NULL)) != NULL);
+}
+
+static void
+add_catalog_entry (gpointer key, gpointer value, gpointer data)
+{
+    JSContextRef context = ((gpointer *) data)[0];
+    JSObjectRef table = ((gpointer *) data)[1];
+    MoEntry *entry = value;
+    JSStringRef name, string;
+    JSValueRef translation;
+    const gchar *form, *end;
+
+    name = JSStringCreateWithUTF8CString (key);
+    form = entry->translation;
+    end = entry->translation + entry->length;
+    if (strlen (form) == entry->length)
+    {
+        string = JSStringCreateWithUTF8CString (form);
+        translation = JSValueMakeString (context, string);
+        JSStringRelease (string);
+    }
+    else
+    {
+        /* Plural forms are NUL separated, hand them over as an array */
+        GPtrArray *forms = g_ptr_array_new ();
+
+        for (; form < end; form += strlen (form) + 1)
+        {
+            string = JSStringCreateWithUTF8CString (form);
+            g_ptr_array_add (forms, (gpointer) JSValueMakeString (context, string));
+            JSStringRelease (string);
+        }
+        translation = JSObjectMakeArray (context, forms->len, (const JSValueRef *) forms->pdata, NULL);
+        g_ptr_array_free (forms, TRUE);
+    }
+
+    JSObjectSetProperty (context, table, name, translation, kJSPropertyAttributeNone, NULL);
+    JSStringRelease (name);
+}
+
+static JSValueRef
+catalog_cb (JSContextRef context,
+            JSObjectRef function,
+            JSObjectRef thisObject,
+            size_t argumentCount,
+            const JSValueRef arguments[],
+            JSValueRef *exception)
+{
+    Catalog *catalog;
+    JSObjectRef table;
+    gchar *domain;
+    gpointer data[2];
+
+    // FIXME: Throw exception
+    if (argumentCount > 1)
+        return JSValueMakeNull (context);
+
+    if (argumentCount == 1 && JSValueGetType (context, arguments[0]) == kJSTypeString)
+    {
+        JSStringRef domain_arg = JSValueToStringCopy (context, arguments[0], NULL);
+        domain = toGChar (domain_arg);
+        JSStringRelease (domain_arg);
+    }
+    else
+        domain = g_strdup (textdomain (NULL));
+
+    table = JSObjectMake (context, NULL, NULL);
+    catalog = get_catalog (current_language, domain);
+    if (catalog != NULL)
+    {
+        data[0] = (gpointer) context;
+        data[1] = table;
+        g_hash_table_foreach (catalog->messages, add_catalog_entry, data);
+    }
+    g_free (domain);
+
+    return table;
+}
+
+static JSValueRef
+gettext_cb (JSContextRef context,
+            JSObjectRef function,
+            JSObjectRef thisObject,
+            size_t argumentCount,
+            const JSValueRef arguments[],
+            JSValueRef *exception)
+{
+    JSStringRef string_arg, result;
+    gchar *string;
+
+    // FIXME: Throw exception
+    if (argumentCount != 1)
+        return JSValueMakeNull (context);
+
+    if (gettext_cache == NULL)
+        gettext_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) JSStringRelease);
+
+    string_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    string = toGChar (string_arg);
+    JSStringRelease (string_arg);
+
+    result = g_hash_table_lookup (gettext_cache, string);
+    if (result == NULL)
+    {
+        result = JSStringCreateWithUTF8CString (translate (string, NULL, 0));
+        g_hash_table_insert (gettext_cache, string, result);
+    }
+    else
+        g_free (string);
+
+    return JSValueMakeString (context, result);
+}
+
+static JSValueRef
+ngettext_cb (JSContextRef context,
+             JSObjectRef function,
+             JSObjectRef thisObject,
+             size_t argumentCount,
+             const JSValueRef arguments[],
+             JSValueRef *exception)
+{
+    JSStringRef string_arg, plural_string_arg, result;
+    gchar *string, *plural_string;
+    JSValueRef value;
+    unsigned int n;
+
+    // FIXME: Throw exception
+    if (argumentCount != 3)
+        return JSValueMakeNull (context);
+
+    string_arg = JSValueToStringCopy (context, arguments[0], NULL);
+    string = toGChar (string_arg);
+    JSStringRelease (string_arg);
+
+    plural_string_arg = JSValueToStringCopy (context, arguments[1], NULL);
+    plural_string = toGChar (plural_string_arg);
+    JSStringRelease (plural_string_arg);
+
+    n = JSValueToNumber (context, arguments[2], NULL);
+
+    result = JSStringCreateWithUTF8CString (translate (string, plural_string, n));
+    value = JSValueMakeString (context, result);
+    JSStringRelease (result);
+    g_free (string);
+    g_free (plural_string);
+
+    return value;
+}
+
+static const JSStaticValue lightdm_user_values[] =
+{
+    USER_FIELDS (STATIC_VALUE_ENTRY, STATIC_VALUE_ENTRY)
+    { NULL, NULL, NULL, 0 }
+};
+
+static const JSStaticValue lightdm_language_values[] =
+{
+    LANGUAGE_FIELDS (STATIC_VALUE_ENTRY)
+    { NULL, NULL, NULL, 0 }
+};
+
+static const JSStaticValue lightdm_layout_values[] =
+{
+    LAYOUT_FIELDS (STATIC_VALUE_ENTRY)
+    { NULL, NULL, NULL, 0 }
+};
+
+static const JSStaticValue lightdm_session_values[] =
+{
+    SESSION_FIELDS (STATIC_VALUE_ENTRY)
+    { NULL, NULL, NULL, 0 }
+};
+
+static const JSStaticValue lightdm_greeter_values[] =
+{
+    { "hostname", get_hostname_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "users", get_users_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "user_table", get_user_table_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "default_language", get_default_language_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "languages", get_languages_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "default_layout", get_default_layout_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "layouts", get_layouts_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "layout", get_layout_cb, set_layout_cb, kJSPropertyAttributeNone },
+    { "sessions", get_sessions_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "session_table", get_session_table_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "avatar_atlas", get_avatar_atlas_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "num_users", get_num_users_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "default_session", get_default_session_cb, NULL, kJSPropertyAttributeNone },
+    { "timed_login_user", get_timed_login_user_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "timed_login_delay", get_timed_login_delay_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "authentication_user", get_authentication_user_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "is_authenticated", get_is_authenticated_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "can_suspend", get_can_suspend_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "can_hibernate", get_can_hibernate_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "can_restart", get_can_restart_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "can_shutdown", get_can_shutdown_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "memory_stats", get_memory_stats_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "language", get_language_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "auth_stats", get_auth_stats_cb, NULL, kJSPropertyAttributeReadOnly },
+    { "last_state", get_last_state_cb, NULL, kJSPropertyAttributeReadOnly },
+    { NULL, NULL, NULL, 0 }
+};
+
+static const JSStaticFunction lightdm_greeter_functions[] =
+{
+    { "cancel_timed_login", cancel_timed_login_cb, kJSPropertyAttributeReadOnly },
+    { "start_authentication", start_authentication_cb, kJSPropertyAttributeReadOnly },
+    { "prepare_authentication", prepare_authentication_cb, kJSPropertyAttributeReadOnly },
+    { "get_user_details", get_user_details_cb, kJSPropertyAttributeReadOnly },
+    { "provide_secret", provide_secret_cb, kJSPropertyAttributeReadOnly },
+    { "cancel_authentication", cancel_authentication_cb, kJSPropertyAttributeReadOnly },
+    { "suspend", suspend_cb, kJSPropertyAttributeReadOnly },
+    { "hibernate", hibernate_cb, kJSPropertyAttributeReadOnly },
+    { "restart", restart_cb, kJSPropertyAttributeReadOnly },
+    { "shutdown", shutdown_cb, kJSPropertyAttributeReadOnly },
+    { "login", login_cb, kJSPropertyAttributeReadOnly },
+    { "getCustomProperty", getCustomProperty_cb, kJSPropertyAttributeReadOnly },
+    { "set_language", set_language_cb, kJSPropertyAttributeReadOnly },
+    { NULL, NULL, 0 }
+};
+
+static const JSStaticFunction gettext_functions[] =
+{
+    { "gettext", gettext_cb, kJSPropertyAttributeReadOnly },
+    { "ngettext", ngettext_cb, kJSPropertyAttributeReadOnly },
+    { "catalog", catalog_cb, kJSPropertyAttributeReadOnly },
+    { NULL, NULL, 0 }
+};
+
+static const JSClassDefinition lightdm_user_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "LightDMUser",             /* Class name */
+    NULL,                  /* Parent class */
+    lightdm_user_values,       /* Static values */
+    NULL,                  /* Static functions */
+    NULL,                  /* Initialize */
+    user_finalize_cb,      /* Finalize */
+};
+
+static const JSClassDefinition lightdm_language_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "LightDMLanguage",         /* Class name */
+    NULL,                  /* Parent class */
+    lightdm_language_values,   /* Static values */
+};
+
+static const JSClassDefinition lightdm_layout_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "LightDMLayout",           /* Class name */
+    NULL,                  /* Parent class */
+    lightdm_layout_values,     /* Static values */
+};
+
+static const JSClassDefinition lightdm_session_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "LightDMSession",          /* Class name */
+    NULL,                  /* Parent class */
+    lightdm_session_values,    /* Static values */
+    NULL,                  /* Static functions */
+    NULL,                  /* Initialize */
+    session_finalize_cb,   /* Finalize */
+};
+
+static const JSClassDefinition lightdm_greeter_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "LightDMGreeter",          /* Class name */
+    NULL,                  /* Parent class */
+    lightdm_greeter_values,    /* Static values */
+    lightdm_greeter_functions, /* Static functions */
+};
+
+static const JSClassDefinition gettext_definition =
+{
+    0,                     /* Version */
+    kJSClassAttributeNone, /* Attributes */
+    "GettextClass",        /* Class name */
+    NULL,                  /* Parent class */
+    NULL,
+    gettext_functions,     /* Static functions */
+};
+
+static void
+window_object_cleared_cb (WebKitWebView  *web_view,
+                          WebKitWebFrame *frame,
+                          JSGlobalContextRef context,
+                          JSObjectRef window_object,
+                          gpointer data)
+{
+    JSObjectRef gettext_object, lightdm_greeter_object;
+
+    /* Cached values belong to the document that is going away */
+    if (frame == webkit_web_view_get_main_frame (web_view) && layouts_array != NULL)
+    {
+        JSValueUnprotect (context, layouts_array);
+        layouts_array = NULL;
+    }
+    if (frame == webkit_web_view_get_main_frame (web_view) && sessions_array != NULL)
+    {
+        JSValueUnprotect (context, sessions_array);
+        sessions_array = NULL;
+    }
+    if (frame == webkit_web_view_get_main_frame (web_view) && languages_array != NULL)
+    {
+        JSValueUnprotect (context, languages_array);
+        languages_array = NULL;
+    }
+    if (frame == webkit_web_view_get_main_frame (web_view))
+    {
+        clear_pending_array (context, &pending_languages);
+        clear_pending_array (context, &pending_layouts);
+        clear_pending_array (context, &pending_user_details);
+    }
+
+    gettext_class = JSClassCreate (&gettext_definition);
+    lightdm_greeter_class = JSClassCreate (&lightdm_greeter_definition);
+    lightdm_user_class = JSClassCreate (&lightdm_user_definition);
+    lightdm_language_class = JSClassCreate (&lightdm_language_definition);
+    lightdm_layout_class = JSClassCreate (&lightdm_layout_definition);
+    lightdm_session_class = JSClassCreate (&lightdm_session_definition);
+
+    gettext_object = JSObjectMake (context, gettext_class, NULL);
+    JSObjectSetProperty (context,
+                         JSContextGetGlobalObject (context),
+                         JSStringCreateWithUTF8CString ("gettext"),
+                         gettext_object, kJSPropertyAttributeNone, NULL);
+
+    lightdm_greeter_object = JSObjectMake (context, lightdm_greeter_class, NULL);
+    JSObjectSetProperty (context,
+                         JSContextGetGlobalObject (context),
+                         JSStringCreateWithUTF8CString ("lightdm"),
+                         lightdm_greeter_object, kJSPropertyAttributeNone, NULL);
+}
+
+/* Warm standby: instead of the daemon starting a fresh greeter after every
+ * logout, GTK+, WebKit and the user list stay up and the hidden greeter is
+ * reset. The theme is reloaded from WebKit's caches, so it starts over with
+ * a clean DOM. Anything half done in C is dropped with it. */
+static gboolean standby_hidden = FALSE;
+
+static void
+set_windows_visible (gboolean visible)
+{
+    GList *link;
+
+    for (link = background_windows; link; link = link->next)
+    {
+        if (visible)
+            gtk_widget_show (link->data);
+        else
+            gtk_widget_hide (link->data);
+    }
+    if (visible)
+        gtk_widget_show (window);
+    else
+        gtk_widget_hide (window);
+}
+
+static void
+standby_hide (void)
+{
+    if (fade_id != 0)
+    {
+        g_source_remove (fade_id);
+        fade_id = 0;
+    }
+    if (standby_hidden)
+        return;
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Session running, greeter on standby");
+    standby_hidden = TRUE;
+    set_windows_visible (FALSE);
+    gtk_window_set_opacity (GTK_WINDOW (window), 1);
+}
+
+/* Once the reloaded theme has painted, the old one must not flash up */
+static void
+standby_show (void)
+{
+    if (!standby_hidden)
+        return;
+
+    standby_hidden = FALSE;
+    set_windows_visible (TRUE);
+    gtk_window_present (GTK_WINDOW (window));
+}
+
+static void start_preauthentication (void);
+
+static void
+standby_idle_cb (void)
+{
+    standby_hide ();
+}
+
+static void
+standby_reset_cb (void)
+{
+    logMessage(G_LOG_LEVEL_MESSAGE, "Session ended, resetting greeter");
+
+    clear_prepared_authentication ();
+    if (backend->get_in_authentication ())
+        backend->cancel_authentication ();
+
+    g_free (current_language);
+    current_language = NULL;
+    if (gettext_cache != NULL)
+        g_hash_table_remove_all (gettext_cache);
+    invalidate_user_details ();
+
+    /* The idle may have been lost, never reload in front of the user */
+    standby_hide ();
+    webkit_web_view_reload (web_view);
+    start_preauthentication ();
+}
+
+/* The most likely user while the theme loads, at start-up and on reset */
+static void
+start_preauthentication (void)
+{
+    const gchar *likely_user;
+
+    if (!preauthenticate || backend->get_autologin_timeout_hint () != 0)
+        return;
+
+    likely_user = backend->get_select_user_hint ();
+    if (likely_user != NULL)
+        prepare_authentication (likely_user);
+}
+
+static void
+sigterm_cb (int signum)
+{
+    exit (0);
+}
+
+
+
+
+
+
+static void
+resource_load_failed_cb(WebKitWebView  *web_view,
+                        WebKitWebFrame *frame,
+                        WebKitWebResource *web_resource,
+                        GError            *err,
+                        LightDMGreeter *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+  logMessage(G_LOG_LEVEL_MESSAGE, "Error loading resource (%s): %s", resourceuri, err->message);
+
+}
+
+static void
+load_finished_cb(WebKitWebResource *web_resource, LightDMGreeter *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in load_finished_cb for: %s", resourceuri);
+
+}
+
+static void
+load_failed_cb(WebKitWebResource *web_resource,
+               GError            *err,
+               LightDMGreeter *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in load_failed_cb for: %s. Error: %s", resourceuri, err->message);
+
+}
+
+static void
+response_received_cb(WebKitWebResource     *web_resource,
+                     WebKitNetworkResponse *response,
+                     LightDMGreeter *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in response_received_cb for: %s", resourceuri);
+}
+
+
+static void
+content_length_received_cb(WebKitWebResource *web_resource,
+                           gint               length_received,
+                           LightDMGreeter    *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in content_length_received_cb for: %s. length: %u", resourceuri, length_received);
+
+}
+
+static void
+header_log_cb(const char *name, const char *value, gpointer resourceuri)
+{
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in header_log_cb for: %s. Header: %s", resourceuri, name);
+}
+
+//Created for debuggin. Not really using this.
+static void
+resource_response_received_cb(WebKitWebView         *web_view,
+                                            WebKitWebFrame        *web_frame,
+                                            WebKitWebResource     *web_resource,
+                                            WebKitNetworkResponse *response,
+                                            LightDMGreeter *greeter)
+{
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in resource_response_received_cb for: %s", resourceuri);
+}
+
+
+//Created for debuggin. Not really using this.
+static void
+resource_request_starting_cb(WebKitWebView  *web_view,
+                        WebKitWebFrame *frame,
+                        WebKitWebResource *web_resource,
+                        WebKitNetworkRequest  *request,
+                        WebKitNetworkResponse *response,
+                        LightDMGreeter *greeter)
+{
+
+  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+
+  gboolean interessa = g_str_has_prefix(resourceuri, "http");
+  if (interessa == TRUE) {
+    logMessage(G_LOG_LEVEL_MESSAGE, "I'm in resource_request_starting_cb for: %s", resourceuri);
+
+    SoupMessage *msg = webkit_network_request_get_message (request);;
+    SoupMessageHeaders *headers = msg->request_headers;
+    soup_message_headers_foreach (headers, header_log_cb, (gpointer) resourceuri);
+
+
+
+    g_signal_connect (G_OBJECT (web_resource), "load-finished", G_CALLBACK (load_finished_cb), greeter);
+    g_signal_connect (G_OBJECT (web_resource), "load-failed", G_CALLBACK (load_failed_cb), greeter);
+    g_signal_connect (G_OBJECT (web_resource), "response-received", G_CALLBACK (response_received_cb), greeter);
+    g_signal_connect (G_OBJECT (web_resource), "content-length-received", G_CALLBACK (content_length_received_cb), greeter);
+  }
+}
+
+/* Requests the theme makes to the network, filtered so the login screen does
+ * not wait on third-party hosts. [request-mirror] maps URL prefixes to
+ * copies under the theme dir, [request-filter] lists hosts to block and
+ * prefixes a caching proxy may answer from its cache without revalidating.
+ * Rules are compiled once at start-up: prefixes into a trie walked one URL
+ * byte at a time, hosts into a hash set probed once per domain label, so a
+ * request costs the length of its URL whatever the number of rules. */
+typedef struct _PrefixNode PrefixNode;
+struct _PrefixNode
+{
+    guchar c;
+    PrefixNode *child;
+    PrefixNode *next;
+    gchar *mirror;      /* local directory for this prefix, or NULL */
+    gboolean cache;     /* prefix listed under cache */
+};
+
+static PrefixNode *prefix_rules = NULL;
+static GHashTable *blocked_hosts = NULL;
+static gint cache_max_stale = 86400;
+
+static PrefixNode *
+prefix_node_child (PrefixNode *node, guchar c, gboolean create)
+{
+    PrefixNode *child;
+
+    for (child = node->child; child; child = child->next)
+        if (child->c == c)
+            return child;
+    if (!create)
+        return NULL;
+
+    child = g_new0 (PrefixNode, 1);
+    child->c = c;
+    child->next = node->child;
+    node->child = child;
+    return child;
+}
+
+static PrefixNode *
+add_prefix_rule (const gchar *prefix)
+{
+    PrefixNode *node;
+    const gchar *c;
+
+    if (prefix_rules == NULL)
+        prefix_rules = g_new0 (PrefixNode, 1);
+    for (node = prefix_rules, c = prefix; *c; c++)
+        node = prefix_node_child (node, *c, TRUE);
+
+    return node;
+}
+
+static void
+request_filter_load (GKeyFile *keyfile)
+{
+    gchar **keys;
+    gsize i, n_keys = 0;
+
+    keys = g_key_file_get_keys (keyfile, "request-mirror", &n_keys, NULL);
+    for (i = 0; i < n_keys; i++)
+    {
+        PrefixNode *node = add_prefix_rule (keys[i]);
+
+        g_free (node->mirror);
+        node->mirror = g_key_file_get_string (keyfile, "request-mirror", keys[i], NULL);
+    }
+    g_strfreev (keys);
+
+    keys = g_key_file_get_string_list (keyfile, "request-filter", "cache", &n_keys, NULL);
+    for (i = 0; i < n_keys; i++)
+        add_prefix_rule (keys[i])->cache = TRUE;
+    g_strfreev (keys);
+    if (g_key_file_has_key (keyfile, "request-filter", "cache-max-stale", NULL))
+        cache_max_stale = MAX (g_key_file_get_integer (keyfile, "request-filter", "cache-max-stale", NULL), 0);
+
+    keys = g_key_file_get_string_list (keyfile, "request-filter", "block", &n_keys, NULL);
+    if (n_keys > 0)
+    {
+        blocked_hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        for (i = 0; i < n_keys; i++)
+            g_hash_table_insert (blocked_hosts, g_ascii_strdown (keys[i], -1), NULL);
+    }
+    g_strfreev (keys);
+}
+
+/* Blocking a domain blocks its subdomains, ads.example.com goes with
+ * example.com */
+static gboolean
+is_blocked_host (const gchar *uri)
+{
+    const gchar *start, *end, *at, *label;
+    gchar *host;
+    gboolean blocked = FALSE;
+
+    start = strstr (uri, "://");
+    if (start == NULL)
+        return FALSE;
+    start += 3;
+    end = start + strcspn (start, "/?#");
+    for (at = start; at < end; at++)
+        if (*at == '@')
+            start = at + 1;
+
+    /* An IPv6 literal is bracketed and full of colons, the port follows the ] */
+    if (*start == '[')
+    {
+        at = memchr (start, ']', end - start);
+        if (at == NULL)
+            return FALSE;
+        host = g_ascii_strdown (start + 1, at - start - 1);
+        blocked = g_hash_table_contains (blocked_hosts, host);
+        g_free (host);
+        return blocked;
+    }
+
+    at = memchr (start, ':', end - start);
+    if (at != NULL)
+        end = at;
+
+    host = g_ascii_strdown (start, end - start);
+    for (label = host; label != NULL && !blocked; label = strchr (label, '.'))
+    {
+        if (*label == '.')
+            label++;
+        blocked = g_hash_table_contains (blocked_hosts, label);
+    }
+    g_free (host);
+
+    return blocked;
+}
+
+/* The longest mirrored prefix, and whether any prefix of the URL is cached */
+static PrefixNode *
+match_prefix_rules (const gchar *uri, gsize *prefix_length, gboolean *cache)
+{
+    PrefixNode *node, *mirror = NULL;
+    const gchar *c;
+
+    *cache = FALSE;
+    for (node = prefix_rules, c = uri; *c && (node = prefix_node_child (node, *c, FALSE)); c++)
+    {
+        if (node->mirror != NULL)
+        {
+            mirror = node;
+            *prefix_length = c - uri + 1;
+        }
+        *cache = *cache || node->cache;
+    }
+
+    return mirror;
+}
+
+static gchar *
+get_mirror_uri (const gchar *uri, PrefixNode *rule, gsize prefix_length)
+{
+    gchar *escaped, *rest, *filename, *mirror_uri = NULL;
+
+    /* The copy on disk has no query or fragment, and is named as the file
+     * was before the URL escaped it. Nothing may climb out of the mirror. */
+    escaped = g_strndup (uri + prefix_length, strcspn (uri + prefix_length, "?#"));
+    rest = g_uri_unescape_string (escaped, NULL);
+    g_free (escaped);
+    if (rest == NULL || strstr (rest, "..") != NULL)
+    {
+        g_free (rest);
+        return NULL;
+    }
+
+    filename = g_build_filename (theme_dir, rule->mirror, rest, NULL);
+    if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+        mirror_uri = g_filename_to_uri (filename, NULL, NULL);
+    g_free (filename);
+    g_free (rest);
+
+    return mirror_uri;
+}
+
+static void
+request_filter_cb (WebKitWebView *web_view,
+                   WebKitWebFrame *frame,
+                   WebKitWebResource *web_resource,
+                   WebKitNetworkRequest *request,
+                   WebKitNetworkResponse *response,
+                   gpointer data)
+{
+    const gchar *uri = webkit_network_request_get_uri (request);
+    PrefixNode *rule = NULL;
+    gsize prefix_length = 0;
+    gboolean cache = FALSE;
+    gchar *mirror_uri;
+    SoupMessage *msg;
+
+    if (uri == NULL || !g_str_has_prefix (uri, "http"))
+        return;
+
+    if (blocked_hosts != NULL && is_blocked_host (uri))
+    {
+        g_debug ("Blocked request for %s", uri);
+        webkit_network_request_set_uri (request, "about:blank");
+        return;
+    }
+
+    if (prefix_rules != NULL)
+        rule = match_prefix_rules (uri, &prefix_length, &cache);
+    if (rule != NULL && (mirror_uri = get_mirror_uri (uri, rule, prefix_length)) != NULL)
+    {
+        g_debug ("Serving %s from %s", uri, mirror_uri);
+        webkit_network_request_set_uri (request, mirror_uri);
+        g_free (mirror_uri);
+        return;
+    }
+
+    /* Lets a caching proxy such as http-proxy answer without asking upstream */
+    msg = webkit_network_request_get_message (request);
+    if (cache && msg != NULL)
+    {
+        gchar *value = g_strdup_printf ("max-stale=%d", cache_max_stale);
+
+        soup_message_headers_replace (msg->request_headers, "Cache-Control", value);
+        g_free (value);
+    }
+}
+
+static gboolean
+request_filter_enabled (void)
+{
+    return prefix_rules != NULL || blocked_hosts != NULL;
+}
+
+/* Must run before the first web view is created, JavaScriptCore reads its
+ * options once when the VM starts. */
+static void
+apply_memory_profile (void)
+{
+    gchar *heap_size;
+
+    if (memory_profile != MEMORY_PROFILE_LOW)
+        return;
+
+    /* The document viewer model keeps the memory cache, and with it decoded
+     * image data, at its minimum. */
+    webkit_set_cache_model (WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER);
+
+    if (js_heap_limit <= 0)
+        js_heap_limit = LOW_MEMORY_JS_HEAP_LIMIT_MB;
+    heap_size = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) js_heap_limit * 1024 * 1024);
+    g_setenv ("JSC_gcMaxHeapSize", heap_size, FALSE);
+    g_free (heap_size);
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Using low memory profile, JS heap limited to %d MB", js_heap_limit);
+}
+
+static WebKitWebSettings *
+create_web_settings (void)
+{
+    WebKitWebSettings *settings = webkit_web_settings_new ();
+
+    g_object_set(G_OBJECT(settings), "enable-universal-access-from-file-uris", TRUE, NULL);
+    g_object_set(G_OBJECT(settings),"enable-file-access-from-file-uris", TRUE, NULL);
+    g_object_set (G_OBJECT(settings), "enable-xss-auditor", FALSE, NULL);
+
+    if (memory_profile == MEMORY_PROFILE_LOW)
+        g_object_set (G_OBJECT (settings),
+                      "enable-page-cache", FALSE,
+                      "enable-plugins", FALSE,
+                      "enable-java-applet", FALSE,
+                      "enable-html5-database", FALSE,
+                      "enable-html5-local-storage", FALSE,
+                      "enable-offline-web-application-cache", FALSE,
+                      "enable-dns-prefetching", FALSE,
+                      NULL);
+
+    return settings;
+}
+
+static gboolean
+trim_memory_cb (gpointer data)
+{
+    gint64 rss_kb, peak_rss_kb;
+
+    JSGarbageCollect (get_global_context ());
+
+    if (read_memory_usage (&rss_kb, &peak_rss_kb))
+        logMessage(G_LOG_LEVEL_MESSAGE, "Resident memory after load: %" G_GINT64_FORMAT " kB (peak %" G_GINT64_FORMAT " kB)", rss_kb, peak_rss_kb);
+
+    return FALSE;
+}
+
+WebKitWebView*
+create_web_view_cb (WebKitWebView  *web_view,
+               WebKitWebFrame *frame,
+               gpointer        user_data)
+{
+    WebKitWebSettings *settings = create_web_settings ();
+
+    webkit_web_view_set_settings (WEBKIT_WEB_VIEW(web_view), settings);
+
+
+    return web_view;
+}
+
+static GdkPixbuf *
+capture_web_view_snapshot (void)
+{
+    GdkPixmap *pixmap;
+    GdkPixbuf *pixbuf;
+    gint width, height;
+
+    if (!gtk_widget_get_mapped (GTK_WIDGET (web_view)))
+        return NULL;
+
+    pixmap = gtk_widget_get_snapshot (GTK_WIDGET (web_view), NULL);
+    if (pixmap == NULL)
+        return NULL;
+
+    gdk_drawable_get_size (GDK_DRAWABLE (pixmap), &width, &height);
+    pixbuf = gdk_pixbuf_get_from_drawable (NULL, GDK_DRAWABLE (pixmap), NULL, 0, 0, 0, 0, width, height);
+    g_object_unref (pixmap);
+
+    return pixbuf;
+}
+
+static GdkPixbuf *
+load_background_pixbuf (void)
+{
+    GError *err = NULL;
+    GdkPixbuf *pixbuf;
+
+    if (background == NULL || background[0] == '\0' || background[0] == '#')
+        return NULL;
+
+    pixbuf = gdk_pixbuf_new_from_file (background, &err);
+    if (pixbuf == NULL) {
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error loading background %s: %s", background, err->message);
+      g_error_free (err);
+    }
+
+    return pixbuf;
+}
+
+static void
+paint_background_window (GtkWidget *bg_window)
+{
+    GtkWidget *image = gtk_bin_get_child (GTK_BIN (bg_window));
+    GdkRectangle *geometry = g_object_get_data (G_OBJECT (bg_window), "geometry");
+    GdkPixbuf *scaled;
+    GdkColor color;
+
+    /* A plain colour wins over the theme snapshot */
+    if (background != NULL && background[0] == '#')
+    {
+        if (gdk_color_parse (background, &color))
+            gtk_widget_modify_bg (bg_window, GTK_STATE_NORMAL, &color);
+        gtk_image_clear (GTK_IMAGE (image));
+        return;
+    }
+
+    if (background_pixbuf == NULL)
+        return;
+
+    scaled = gdk_pixbuf_scale_simple (background_pixbuf, geometry->width, geometry->height, GDK_INTERP_BILINEAR);
+    gtk_image_set_from_pixbuf (GTK_IMAGE (image), scaled);
+    g_object_unref (scaled);
+}
+
+static GtkWidget *
+create_background_window (GdkRectangle *monitor_geometry)
+{
+    GtkWidget *bg_window, *image;
+    GdkRectangle *geometry;
+    GdkColor color;
+
+    bg_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_decorated (GTK_WINDOW (bg_window), FALSE);
+    gtk_window_set_accept_focus (GTK_WINDOW (bg_window), FALSE);
+    gtk_window_set_default_size (GTK_WINDOW (bg_window), monitor_geometry->width, monitor_geometry->height);
+    gtk_window_move (GTK_WINDOW (bg_window), monitor_geometry->x, monitor_geometry->y);
+
+    if (background != NULL && gdk_color_parse (background, &color))
+        gtk_widget_modify_bg (bg_window, GTK_STATE_NORMAL, &color);
+    else if (gdk_color_parse ("#000000", &color))
+        gtk_widget_modify_bg (bg_window, GTK_STATE_NORMAL, &color);
+
+    geometry = g_memdup (monitor_geometry, sizeof (GdkRectangle));
+    g_object_set_data_full (G_OBJECT (bg_window), "geometry", geometry, g_free);
+
+    image = gtk_image_new ();
+    gtk_container_add (GTK_CONTAINER (bg_window), image);
+    paint_background_window (bg_window);
+    gtk_widget_show (image);
+    /* A monitor plugged in during warm standby waits for standby_show */
+    if (!standby_hidden)
+        gtk_widget_show (bg_window);
+
+    return bg_window;
+}
+
+static void
+update_monitors (GdkScreen *screen)
+{
+    GdkRectangle geometry;
+    gint primary, n_monitors, i;
+
+    g_list_free_full (background_windows, (GDestroyNotify) gtk_widget_destroy);
+    background_windows = NULL;
+
+    primary = gdk_screen_get_primary_monitor (screen);
+    n_monitors = gdk_screen_get_n_monitors (screen);
+
+    gdk_screen_get_monitor_geometry (screen, primary, &geometry);
+    gtk_window_set_default_size (GTK_WINDOW (window), geometry.width, geometry.height);
+    gtk_window_resize (GTK_WINDOW (window), geometry.width, geometry.height);
+    gtk_window_move (GTK_WINDOW (window), geometry.x, geometry.y);
+
+    for (i = 0; i < n_monitors; i++)
+    {
+        if (i == primary)
+            continue;
+
+        gdk_screen_get_monitor_geometry (screen, i, &geometry);
+        background_windows = g_list_append (background_windows, create_background_window (&geometry));
+    }
+
+    logMessage(G_LOG_LEVEL_MESSAGE, "Using monitor %d of %d for the greeter", primary, n_monitors);
+}
+
+static gboolean snapshot_cb (gpointer data);
+
+static void
+monitors_changed_cb (GdkScreen *screen, gpointer data)
+{
+    update_monitors (screen);
+
+    /* A monitor plugged in after the theme loaded still needs a snapshot */
+    if (background_pixbuf == NULL && webkit_web_view_get_load_status (web_view) == WEBKIT_LOAD_FINISHED)
+        g_idle_add (snapshot_cb, NULL);
+}
 
-static const JSClassDefinition lightdm_language_definition =
+static void
+hash_theme_dir (GChecksum *checksum, const gchar *path)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "LightDMLanguage",         /* Class name */
-    NULL,                  /* Parent class */
-    lightdm_language_values,   /* Static values */
-};
+    GDir *dir;
+    GList *names = NULL, *link;
+    const gchar *name;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name (dir)))
+        names = g_list_prepend (names, g_strdup (name));
+    g_dir_close (dir);
+
+    /* Directory order is not stable, sort so the hash is */
+    names = g_list_sort (names, (GCompareFunc) g_strcmp0);
+    for (link = names; link; link = link->next)
+    {
+        gchar *child = g_build_filename (path, link->data, NULL);
+        GStatBuf info;
+
+        if (g_stat (child, &info) == 0)
+        {
+            if (S_ISDIR (info.st_mode))
+                hash_theme_dir (checksum, child);
+            else
+            {
+                gchar *entry = g_strdup_printf ("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT, child, (gint64) info.st_size, (gint64) info.st_mtime);
+                g_checksum_update (checksum, (const guchar *) entry, -1);
+                g_free (entry);
+            }
+        }
+        g_free (child);
+    }
+    g_list_free_full (names, g_free);
+}
 
-static const JSClassDefinition lightdm_layout_definition =
+/* Hashing path, size and mtime of every theme file rather than the contents
+ * keeps this cheap enough to run before the first frame. */
+static gchar *
+compute_theme_hash (void)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "LightDMLayout",           /* Class name */
-    NULL,                  /* Parent class */
-    lightdm_layout_values,     /* Static values */
-};
+    GChecksum *checksum;
+    gchar *theme_dir, *hash;
 
-static const JSClassDefinition lightdm_session_definition =
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+    theme_dir = g_build_filename (THEME_DIR, theme, NULL);
+    hash_theme_dir (checksum, theme_dir);
+    hash = g_strdup (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+    g_free (theme_dir);
+
+    return hash;
+}
+
+static gchar *
+get_splash_filename (gint width, gint height)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "LightDMSession",          /* Class name */
-    NULL,                  /* Parent class */
-    lightdm_session_values,    /* Static values */
-};
+    gchar *name, *filename;
 
-static const JSClassDefinition lightdm_greeter_definition =
+    if (theme_hash == NULL)
+        theme_hash = compute_theme_hash ();
+
+    name = g_strdup_printf ("splash-%s-%dx%d.png", theme_hash, width, height);
+    filename = get_cache_filename (name);
+    g_free (name);
+
+    return filename;
+}
+
+static gpointer
+save_splash_thread (gpointer data)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "LightDMGreeter",          /* Class name */
-    NULL,                  /* Parent class */
-    lightdm_greeter_values,    /* Static values */
-    lightdm_greeter_functions, /* Static functions */
-};
+    GdkPixbuf *pixbuf = data;
+    GError *err = NULL;
+    gchar *filename, *tmp_filename, *dir;
+
+    filename = get_splash_filename (gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
+    tmp_filename = g_strdup_printf ("%s.tmp", filename);
+    dir = g_path_get_dirname (filename);
+    g_mkdir_with_parents (dir, 0700);
+
+    /* Written next to the final name and renamed, a half written splash must never be shown */
+    if (gdk_pixbuf_save (pixbuf, tmp_filename, "png", &err, "compression", "1", NULL))
+        g_rename (tmp_filename, filename);
+    else {
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error saving splash %s: %s", tmp_filename, err->message);
+      g_error_free (err);
+      g_unlink (tmp_filename);
+    }
 
-static const JSClassDefinition gettext_definition =
+    g_free (dir);
+    g_free (tmp_filename);
+    g_free (filename);
+    g_object_unref (pixbuf);
+
+    return NULL;
+}
+
+static void
+show_splash (GdkRectangle *geometry)
 {
-    0,                     /* Version */
-    kJSClassAttributeNone, /* Attributes */
-    "GettextClass",        /* Class name */
-    NULL,                  /* Parent class */
-    NULL,
-    gettext_functions,     /* Static functions */
-};
+    GdkPixbuf *pixbuf;
+    gchar *filename;
+
+    filename = get_splash_filename (geometry->width, geometry->height);
+    pixbuf = gdk_pixbuf_new_from_file (filename, NULL);
+    if (pixbuf != NULL)
+    {
+        logMessage(G_LOG_LEVEL_MESSAGE, "Showing splash %s until the theme has loaded", filename);
+        splash_image = gtk_image_new_from_pixbuf (pixbuf);
+        gtk_container_add (GTK_CONTAINER (window), splash_image);
+        g_object_unref (pixbuf);
+    }
+    g_free (filename);
+}
 
 static void
-window_object_cleared_cb (WebKitWebView  *web_view,
-                          WebKitWebFrame *frame,
-                          JSGlobalContextRef context,
-                          JSObjectRef window_object,
-                          LightDMGreeter *greeter)
+hide_splash (void)
 {
-    JSObjectRef gettext_object, lightdm_greeter_object;
+    if (splash_image == NULL)
+        return;
 
-    gettext_class = JSClassCreate (&gettext_definition);
-    lightdm_greeter_class = JSClassCreate (&lightdm_greeter_definition);
-    lightdm_user_class = JSClassCreate (&lightdm_user_definition);
-    lightdm_language_class = JSClassCreate (&lightdm_language_definition);
-    lightdm_layout_class = JSClassCreate (&lightdm_layout_definition);
-    lightdm_session_class = JSClassCreate (&lightdm_session_definition);
+    gtk_container_remove (GTK_CONTAINER (window), splash_image);
+    splash_image = NULL;
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (web_view));
+    gtk_widget_show (GTK_WIDGET (web_view));
+}
 
-    gettext_object = JSObjectMake (context, gettext_class, NULL);
-    JSObjectSetProperty (context,
-                         JSContextGetGlobalObject (context),
-                         JSStringCreateWithUTF8CString ("gettext"),
-                         gettext_object, kJSPropertyAttributeNone, NULL);
+static gboolean
+snapshot_cb (gpointer data)
+{
+    GdkPixbuf *snapshot;
+    GList *link;
+    gchar *filename;
 
-    lightdm_greeter_object = JSObjectMake (context, lightdm_greeter_class, greeter);
-    JSObjectSetProperty (context,
-                         JSContextGetGlobalObject (context),
-                         JSStringCreateWithUTF8CString ("lightdm"),
-                         lightdm_greeter_object, kJSPropertyAttributeNone, NULL);
+    snapshot = capture_web_view_snapshot ();
+    if (snapshot == NULL)
+        return FALSE;
+
+    /* Reloads and hotplugs of an unchanged theme already have theirs */
+    filename = get_splash_filename (gdk_pixbuf_get_width (snapshot), gdk_pixbuf_get_height (snapshot));
+    if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+        g_thread_unref (g_thread_new ("save-splash", save_splash_thread, g_object_ref (snapshot)));
+    g_free (filename);
+
+    if (background_pixbuf == NULL && (background == NULL || background[0] != '#'))
+    {
+        background_pixbuf = g_object_ref (snapshot);
+        for (link = background_windows; link; link = link->next)
+            paint_background_window (link->data);
+    }
+    g_object_unref (snapshot);
+
+    return FALSE;
 }
 
 static void
-sigterm_cb (int signum)
+load_status_cb (WebKitWebView *view, GParamSpec *pspec, gpointer data)
 {
-    exit (0);
+    switch (webkit_web_view_get_load_status (view))
+    {
+    case WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT:
+        if (benchmark_theme != NULL && benchmark.first_paint == 0)
+            benchmark.first_paint = g_get_monotonic_time ();
+        standby_show ();
+        break;
+    case WEBKIT_LOAD_FINISHED:
+        standby_show ();
+        if (benchmark_theme != NULL)
+        {
+            benchmark_loaded ();
+            break;
+        }
+        hide_splash ();
+        g_timeout_add (SNAPSHOT_DELAY_MS, snapshot_cb, NULL);
+        if (memory_profile == MEMORY_PROFILE_LOW)
+            g_timeout_add (SNAPSHOT_DELAY_MS * 2, trim_memory_cb, NULL);
+        break;
+    case WEBKIT_LOAD_FAILED:
+        /* Never leave a picture of a login screen up in place of a broken one */
+        hide_splash ();
+        standby_show ();
+        break;
+    default:
+        break;
+    }
 }
 
+static gchar *
+benchmark_first_user (void)
+{
+    const GList *users = backend->get_users ();
+
+    return users ? g_strdup (backend->user_get_name (users->data)) : NULL;
+}
 
+/* Calls lightdm.<method>(argument) as the theme would. The argument goes
+ * in as a JS value, a user name never ends up inside script source. */
+static void
+benchmark_call_lightdm (const gchar *method, const gchar *argument)
+{
+    JSContextRef context = get_global_context ();
+    JSStringRef name;
+    JSValueRef value, args[1];
+    JSObjectRef lightdm_object, function;
+
+    name = JSStringCreateWithUTF8CString ("lightdm");
+    value = JSObjectGetProperty (context, JSContextGetGlobalObject (context), name, NULL);
+    JSStringRelease (name);
+    if (value == NULL || !JSValueIsObject (context, value))
+        return;
+    lightdm_object = JSValueToObject (context, value, NULL);
+
+    name = JSStringCreateWithUTF8CString (method);
+    value = JSObjectGetProperty (context, lightdm_object, name, NULL);
+    JSStringRelease (name);
+    if (value == NULL || !JSValueIsObject (context, value))
+        return;
+    function = JSValueToObject (context, value, NULL);
+    if (!JSObjectIsFunction (context, function))
+        return;
+
+    args[0] = make_js_string (context, argument);
+    JSObjectCallAsFunction (context, function, lightdm_object, 1, args, NULL);
+}
 
+/* Input is handled from the first main loop iteration with nothing else
+ * left to do once the page has loaded */
+static gboolean
+benchmark_interactive_cb (gpointer data)
+{
+    gchar *name;
 
-static void logMessage(GLogLevelFlags level, const gchar* format, ... ) {
-  va_list args;
+    benchmark.interactive = g_get_monotonic_time ();
 
-  GDateTime *dateTime = g_date_time_new_now_local ();
-  gchar* strDateTime = g_date_time_format(dateTime, "%F %T");
-  g_date_time_unref(dateTime);
+    name = benchmark_first_user ();
+    if (name == NULL)
+    {
+        benchmark_finish ();
+        return FALSE;
+    }
 
-  //Alter format string, including the date/time.
-  const gchar* newFormat = g_strdup_printf("%s-> %s", strDateTime, format);
-  g_free(strDateTime);
+    benchmark.auth_started = g_get_monotonic_time ();
+    benchmark_call_lightdm ("start_authentication", name);
+    g_free (name);
 
-  //Call g_logv with arguments sent.
-  va_start (args, format);
-  g_logv(G_LOG_DOMAIN, level, newFormat, args);
-  va_end (args);
+    return FALSE;
 }
 
-
 static void
-resource_load_failed_cb(WebKitWebView  *web_view,
-                        WebKitWebFrame *frame,
-                        WebKitWebResource *web_resource,
-                        GError            *err,
-                        LightDMGreeter *greeter)
+benchmark_loaded (void)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
-  logMessage(G_LOG_LEVEL_MESSAGE, "Error loading resource (%s): %s", resourceuri, err->message);
+    if (benchmark.loaded != 0)
+        return;
 
+    benchmark.loaded = g_get_monotonic_time ();
+    g_idle_add_full (G_PRIORITY_LOW, benchmark_interactive_cb, NULL, NULL);
 }
 
-static void
-load_finished_cb(WebKitWebResource *web_resource, LightDMGreeter *greeter)
+/* Types the password once the theme had a chance to show the prompt, the
+ * theme's authentication_complete() is expected to call lightdm.login() */
+static gboolean
+benchmark_respond_cb (gpointer data)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+    gchar *name;
 
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in load_finished_cb for: %s", resourceuri);
+    name = benchmark_first_user ();
+    benchmark_call_lightdm ("provide_secret", name);
+    g_free (name);
 
+    return FALSE;
 }
 
 static void
-load_failed_cb(WebKitWebResource *web_resource,
-               GError            *err,
-               LightDMGreeter *greeter)
+benchmark_prompted (void)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in load_failed_cb for: %s. Error: %s", resourceuri, err->message);
+    if (benchmark.auth_started == 0)
+        return;
 
+    /* Every prompt gets the same answer, only the first one is timed */
+    if (benchmark.prompted == 0)
+        benchmark.prompted = g_get_monotonic_time ();
+    g_idle_add (benchmark_respond_cb, NULL);
 }
 
-static void
-response_received_cb(WebKitWebResource     *web_resource,
-                     WebKitNetworkResponse *response,
-                     LightDMGreeter *greeter)
+static gboolean
+benchmark_timeout_cb (gpointer data)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in response_received_cb for: %s", resourceuri);
-}
+    benchmark.timed_out = TRUE;
+    benchmark_finish ();
 
+    return FALSE;
+}
 
 static void
-content_length_received_cb(WebKitWebResource *web_resource,
-                           gint               length_received,
-                           LightDMGreeter    *greeter)
+benchmark_print_ms (const gchar *name, gint64 from, gint64 to)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in content_length_received_cb for: %s. length: %u", resourceuri, length_received);
+    if (from == 0 || to == 0)
+        g_print ("  \"%s\": null,\n", name);
+    else
+        g_print ("  \"%s\": %.1f,\n", name, (to - from) / 1000.0);
+}
 
+static gint64
+benchmark_js_heap_kb (void)
+{
+#ifdef HAVE_JSGETMEMORYUSAGESTATISTICS
+    JSContextRef context = get_global_context ();
+    JSStringRef name;
+    JSValueRef value;
+    gint64 heap_kb = -1;
+
+    JSGarbageCollect (context);
+    name = JSStringCreateWithUTF8CString ("heapSize");
+    value = JSObjectGetProperty (context, JSGetMemoryUsageStatistics (context), name, NULL);
+    JSStringRelease (name);
+    if (value != NULL && JSValueIsNumber (context, value))
+        heap_kb = JSValueToNumber (context, value, NULL) / 1024;
+
+    return heap_kb;
+#else
+    return -1;
+#endif
 }
 
-static void
-header_log_cb(const char *name, const char *value, gpointer resourceuri)
+/* Reads every field of every user the way a theme listing them would, once
+ * through the wrappers and once through the JSON table */
+static gint64
+benchmark_read_users (const gchar *property)
 {
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in header_log_cb for: %s. Header: %s", resourceuri, name);
+    JSContextRef context = get_global_context ();
+    JSStringRef script;
+    gchar *source;
+    gint64 started;
+
+    source = g_strdup_printf ("(function () {"
+                              "  var users = lightdm.%s, n = 0, i, u;"
+                              "  for (i = 0; i < users.length; i++) {"
+                              "    u = users[i];"
+                              "    n += String (u.name) + u.real_name + u.display_name + u.image +"
+                              "         u.language + u.layout + u.session + u.logged_in;"
+                              "  }"
+                              "  return n;"
+                              "}) ()", property);
+    script = JSStringCreateWithUTF8CString (source);
+    g_free (source);
+
+    started = g_get_monotonic_time ();
+    JSEvaluateScript (context, script, NULL, NULL, 0, NULL);
+    JSStringRelease (script);
+
+    return g_get_monotonic_time () - started;
 }
 
-//Created for debuggin. Not really using this.
 static void
-resource_response_received_cb(WebKitWebView         *web_view,
-                                            WebKitWebFrame        *web_frame,
-                                            WebKitWebResource     *web_resource,
-                                            WebKitNetworkResponse *response,
-                                            LightDMGreeter *greeter)
+benchmark_finish (void)
 {
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
-  logMessage(G_LOG_LEVEL_MESSAGE, "I'm in resource_response_received_cb for: %s", resourceuri);
+    static gboolean finished = FALSE;
+    gint64 rss_kb = 0, peak_rss_kb = 0, js_heap_kb, users_wrapper_us, users_table_us;
+
+    if (finished)
+        return;
+    finished = TRUE;
+
+    read_memory_usage (&rss_kb, &peak_rss_kb);
+    js_heap_kb = benchmark_js_heap_kb ();
+    users_wrapper_us = benchmark_read_users ("users");
+    users_table_us = benchmark_read_users ("user_table");
+
+    g_print ("{\n");
+    g_print ("  \"theme\": \"%s\",\n", theme_dir);
+    g_print ("  \"users\": %u,\n", g_list_length ((GList *) backend->get_users ()));
+    benchmark_print_ms ("first_paint_ms", benchmark.started, benchmark.first_paint);
+    benchmark_print_ms ("loaded_ms", benchmark.started, benchmark.loaded);
+    benchmark_print_ms ("interactive_ms", benchmark.started, benchmark.interactive);
+    benchmark_print_ms ("prompt_ms", benchmark.auth_started, benchmark.prompted);
+    benchmark_print_ms ("login_ms", benchmark.auth_started, benchmark.session_started);
+    g_print ("  \"users_wrapper_ms\": %.1f,\n", users_wrapper_us / 1000.0);
+    g_print ("  \"users_table_ms\": %.1f,\n", users_table_us / 1000.0);
+    g_print ("  \"peak_rss_kb\": %" G_GINT64_FORMAT ",\n", peak_rss_kb);
+    if (js_heap_kb < 0)
+        g_print ("  \"js_heap_kb\": null,\n");
+    else
+        g_print ("  \"js_heap_kb\": %" G_GINT64_FORMAT ",\n", js_heap_kb);
+    g_print ("  \"timed_out\": %s\n", benchmark.timed_out ? "true" : "false");
+    g_print ("}\n");
+
+    gtk_main_quit ();
 }
 
+static GOptionEntry options[] =
+{
+    { "backend", 0, 0, G_OPTION_ARG_STRING, &backend_name,
+      "lightdm (default), or fake to run without a daemon, see [fake-backend] in the configuration", "NAME" },
+    { "benchmark-theme", 0, 0, G_OPTION_ARG_FILENAME, &benchmark_theme,
+      "Load the theme in DIR offscreen against a stand-in daemon, log in and print timings", "DIR" },
+    { "benchmark-users", 0, 0, G_OPTION_ARG_INT, &benchmark_users,
+      "Synthetic users for --benchmark-theme, overrides [fake-backend] (default 100)", "N" },
+    { "benchmark-timeout", 0, 0, G_OPTION_ARG_INT, &benchmark_timeout,
+      "Seconds before --benchmark-theme gives up (default 60)", "SECONDS" },
+    { "compile-users-conf", 0, 0, G_OPTION_ARG_FILENAME, &compile_users_conf_file,
+      "Compile a theme's users.conf into users.db next to it for getCustomProperty, and exit", "FILE" },
+    { NULL }
+};
 
-//Created for debuggin. Not really using this.
-static void
-resource_request_starting_cb(WebKitWebView  *web_view,
-                        WebKitWebFrame *frame,
-                        WebKitWebResource *web_resource,
-                        WebKitNetworkRequest  *request,
-                        WebKitNetworkResponse *response,
-                        LightDMGreeter *greeter)
+/* --compile-users-conf runs on build and packaging hosts without a display,
+ * so it is picked out before GTK+ gets to open one. The rest of the command
+ * line is left for gtk_init_with_args, which also lists it in --help. */
+static gboolean
+compile_users_conf_requested (gint argc, gchar **argv)
 {
+    static GOptionEntry compile_options[] =
+    {
+        { "compile-users-conf", 0, 0, G_OPTION_ARG_FILENAME, &compile_users_conf_file, NULL, NULL },
+        { NULL }
+    };
+    GOptionContext *context;
+    gchar **args;
+    gint n_args = argc;
+
+    /* A shallow copy, parsing reorders the array it is given */
+    args = g_memdup (argv, (argc + 1) * sizeof (gchar *));
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, compile_options, NULL);
+    g_option_context_set_ignore_unknown_options (context, TRUE);
+    g_option_context_set_help_enabled (context, FALSE);
+    g_option_context_parse (context, &n_args, &args, NULL);
+    g_option_context_free (context);
+    g_free (args);
 
-  const gchar* resourceuri = webkit_web_resource_get_uri(web_resource);
+    return compile_users_conf_file != NULL;
+}
 
-  gboolean interessa = g_str_has_prefix(resourceuri, "http");
-  if (interessa == TRUE) {
-    logMessage(G_LOG_LEVEL_MESSAGE, "I'm in resource_request_starting_cb for: %s", resourceuri);
+static const BackendEvents backend_events =
+{
+    .show_prompt = show_prompt_cb,
+    .show_message = show_message_cb,
+    .authentication_complete = authentication_complete_cb,
+    .autologin_timer_expired = autologin_timeout_expired_cb,
+    .user_added = user_added_cb,
+    .user_changed = user_changed_cb,
+    .user_removed = user_removed_cb,
+    .idle = standby_idle_cb,
+    .reset = standby_reset_cb,
+};
 
-    SoupMessage *msg = webkit_network_request_get_message (request);;
-    SoupMessageHeaders *headers = msg->request_headers;
-    soup_message_headers_foreach (headers, header_log_cb, (gpointer) resourceuri);
+/* Keys of the [greeter] group, modelled on the GOptionEntry table above.
+ * The file is parsed once and every value checked before it lands in the
+ * variable it configures, a key that is missing or does not validate
+ * leaves the built-in default. */
+typedef enum
+{
+    CONFIG_STRING,
+    CONFIG_STRING_LIST,
+    CONFIG_BOOLEAN,
+    CONFIG_INT,
+    CONFIG_CHOICE
+} ConfigType;
+
+typedef struct
+{
+    const gchar *key;
+    ConfigType type;
+    gpointer value;
+    gint min, max;                 /* CONFIG_INT */
+    const gchar * const *choices;  /* CONFIG_CHOICE, the value is the index */
+} ConfigKey;
+
+#define CONFIG_GROUP "greeter"
+
+/* Applied to GtkSettings before the web view exists, -1 or NULL is unset */
+static gchar *gtk_theme_name = NULL;
+static gchar *gtk_font_name = NULL;
+static gint xft_antialias = -1;
+static gint xft_dpi = -1;
+static gint xft_hintstyle = -1;
+static gint xft_rgba = -1;
+static gchar *http_proxy = NULL;
+
+static const gchar * const memory_profile_choices[] = { "default", "low", NULL };
+/* Both spellings are around, hintnone and none mean the same */
+static const gchar * const xft_hintstyle_choices[] = { "hintnone", "hintslight", "hintmedium", "hintfull",
+                                                       "none", "slight", "medium", "full", NULL };
+static const gchar * const xft_rgba_choices[] = { "none", "rgb", "bgr", "vrgb", "vbgr", NULL };
+
+static const ConfigKey config_keys[] =
+{
+    { "webkit-theme", CONFIG_STRING, &theme },
+    { "background", CONFIG_STRING, &background },
+    { "http-proxy", CONFIG_STRING, &http_proxy },
+    { "theme-name", CONFIG_STRING, &gtk_theme_name },
+    { "font-name", CONFIG_STRING, &gtk_font_name },
+    { "xft-antialias", CONFIG_BOOLEAN, &xft_antialias },
+    { "xft-dpi", CONFIG_INT, &xft_dpi, 1, 1000 },
+    { "xft-hintstyle", CONFIG_CHOICE, &xft_hintstyle, 0, 0, xft_hintstyle_choices },
+    { "xft-rgba", CONFIG_CHOICE, &xft_rgba, 0, 0, xft_rgba_choices },
+    { "memory-profile", CONFIG_CHOICE, &memory_profile, 0, 0, memory_profile_choices },
+    { "js-heap-limit", CONFIG_INT, &js_heap_limit, 1, 4096 },
+    { "keyboard-layouts", CONFIG_STRING_LIST, &keyboard_layouts },
+    { "preauthenticate", CONFIG_BOOLEAN, &preauthenticate },
+    { "languages", CONFIG_STRING_LIST, &preload_languages },
+    { "avatar-atlas-size", CONFIG_INT, &avatar_atlas_size, 0, 512 },
+    { "fade-duration", CONFIG_INT, &fade_duration, 0, 10000 },
+    { "warm-standby", CONFIG_BOOLEAN, &warm_standby },
+    { "stall-threshold", CONFIG_INT, &stall_threshold, 0, 60000 },
+    { NULL }
+};
 
+static gboolean
+load_config_key (GKeyFile *keyfile, const ConfigKey *entry, GError **error)
+{
+    gchar *string;
+    gint i, number;
+    gboolean flag;
 
+    switch (entry->type)
+    {
+    case CONFIG_STRING:
+        string = g_key_file_get_string (keyfile, CONFIG_GROUP, entry->key, error);
+        if (string == NULL)
+            return FALSE;
+        /* An empty value is the same as leaving the key out */
+        if (string[0] == '\0')
+        {
+            g_free (string);
+            return TRUE;
+        }
+        *(gchar **) entry->value = string;
+        return TRUE;
+
+    case CONFIG_STRING_LIST:
+        *(gchar ***) entry->value = g_key_file_get_string_list (keyfile, CONFIG_GROUP, entry->key, NULL, error);
+        return *(gchar ***) entry->value != NULL;
+
+    case CONFIG_BOOLEAN:
+        flag = g_key_file_get_boolean (keyfile, CONFIG_GROUP, entry->key, error);
+        if (error != NULL && *error != NULL)
+            return FALSE;
+        *(gint *) entry->value = flag;
+        return TRUE;
+
+    case CONFIG_INT:
+        number = g_key_file_get_integer (keyfile, CONFIG_GROUP, entry->key, error);
+        if (error != NULL && *error != NULL)
+            return FALSE;
+        if (number < entry->min || number > entry->max)
+        {
+            g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                         "%d is out of range, expected %d to %d", number, entry->min, entry->max);
+            return FALSE;
+        }
+        *(gint *) entry->value = number;
+        return TRUE;
+
+    case CONFIG_CHOICE:
+        string = g_key_file_get_string (keyfile, CONFIG_GROUP, entry->key, error);
+        if (string == NULL)
+            return FALSE;
+        for (i = 0; entry->choices[i] != NULL; i++)
+        {
+            if (g_strcmp0 (string, entry->choices[i]) == 0)
+            {
+                *(gint *) entry->value = i;
+                g_free (string);
+                return TRUE;
+            }
+        }
+        g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE, "Unknown value %s", string);
+        g_free (string);
+        return FALSE;
+    }
 
-    g_signal_connect (G_OBJECT (web_resource), "load-finished", G_CALLBACK (load_finished_cb), greeter);
-    g_signal_connect (G_OBJECT (web_resource), "load-failed", G_CALLBACK (load_failed_cb), greeter);
-    g_signal_connect (G_OBJECT (web_resource), "response-received", G_CALLBACK (response_received_cb), greeter);
-    g_signal_connect (G_OBJECT (web_resource), "content-length-received", G_CALLBACK (content_length_received_cb), greeter);
-  }
+    return FALSE;
 }
 
-WebKitWebView*
-create_web_view_cb (WebKitWebView  *web_view,
-               WebKitWebFrame *frame,
-               gpointer        user_data)
+static void
+load_config (GKeyFile *keyfile)
 {
-    WebKitWebSettings *settings = webkit_web_settings_new ();
+    const ConfigKey *entry;
+    gchar **keys;
+    gsize i;
 
-    g_object_set(G_OBJECT(settings), "enable-universal-access-from-file-uris", TRUE, NULL);
-    g_object_set(G_OBJECT(settings),"enable-file-access-from-file-uris", TRUE, NULL);
-    g_object_set (G_OBJECT(settings), "enable-xss-auditor", FALSE, NULL);
-    webkit_web_view_set_settings (WEBKIT_WEB_VIEW(web_view), settings);
+    for (entry = config_keys; entry->key != NULL; entry++)
+    {
+        GError *error = NULL;
+
+        if (!g_key_file_has_key (keyfile, CONFIG_GROUP, entry->key, NULL))
+            continue;
+        if (!load_config_key (keyfile, entry, &error))
+        {
+            logMessage(G_LOG_LEVEL_WARNING, "Ignoring %s in the configuration: %s", entry->key, error->message);
+            g_error_free (error);
+        }
+    }
 
+    /* Most likely a typo of a key above */
+    keys = g_key_file_get_keys (keyfile, CONFIG_GROUP, NULL, NULL);
+    for (i = 0; keys != NULL && keys[i] != NULL; i++)
+    {
+        for (entry = config_keys; entry->key != NULL; entry++)
+            if (g_strcmp0 (entry->key, keys[i]) == 0)
+                break;
+        if (entry->key == NULL)
+            logMessage(G_LOG_LEVEL_WARNING, "Unknown key %s in the configuration", keys[i]);
+    }
+    g_strfreev (keys);
+}
 
-    return web_view;
+/* Set before WebKit creates its first font so the theme is laid out once,
+ * with the configured fonts, and not again when they change under it */
+static void
+apply_gtk_settings (GdkScreen *screen)
+{
+    GtkSettings *settings = gtk_settings_get_for_screen (screen);
+
+    if (gtk_theme_name != NULL)
+        g_object_set (settings, "gtk-theme-name", gtk_theme_name, NULL);
+    if (gtk_font_name != NULL)
+        g_object_set (settings, "gtk-font-name", gtk_font_name, NULL);
+    if (xft_antialias >= 0)
+        g_object_set (settings, "gtk-xft-antialias", xft_antialias, NULL);
+    if (xft_dpi > 0)
+        g_object_set (settings, "gtk-xft-dpi", xft_dpi * 1024, NULL);
+    if (xft_hintstyle >= 0)
+        g_object_set (settings, "gtk-xft-hintstyle", xft_hintstyle_choices[xft_hintstyle % 4], NULL);
+    if (xft_rgba >= 0)
+        g_object_set (settings, "gtk-xft-rgba", xft_rgba_choices[xft_rgba], NULL);
 }
 
 static void sethttpproxy(const gchar *httpproxy)
@@ -1283,48 +5659,75 @@ static void sethttpproxy(const gchar *httpproxy)
 int
 main (int argc, char **argv)
 {
-    LightDMGreeter *greeter;
     GdkScreen *screen;
     GdkRectangle geometry;
     GKeyFile *keyfile;
 
     signal (SIGTERM, sigterm_cb);
 
-    gtk_init (&argc, &argv);
-    gdk_window_set_cursor (gdk_get_default_root_window (), gdk_cursor_new (GDK_LEFT_PTR));
-    greeter = lightdm_greeter_new ();
-
     /* settings */
     GError *err = NULL;
 
+    benchmark.started = g_get_monotonic_time ();
+    if (compile_users_conf_requested (argc, argv)) {
+      if (!compile_users_conf (compile_users_conf_file, &err)) {
+        g_printerr ("%s: %s\n", compile_users_conf_file, err->message);
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    }
+
+    if (!gtk_init_with_args (&argc, &argv, NULL, options, NULL, &err)) {
+      g_printerr ("%s\n", err ? err->message : "Cannot open display");
+      return EXIT_FAILURE;
+    }
+
+    bindtextdomain (GETTEXT_PACKAGE, LOCALE_DIR);
+    bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+    textdomain (GETTEXT_PACKAGE);
+    gdk_window_set_cursor (gdk_get_default_root_window (), gdk_cursor_new (GDK_LEFT_PTR));
+
     keyfile = g_key_file_new ();
-    gboolean fileFound = g_key_file_load_from_file (keyfile, "/etc/lightdm/lightdm-tex-greeter.conf", G_KEY_FILE_NONE, &err);
+    gchar *configFile = g_build_filename (CONFIG_DIR, "lightdm-tex-greeter.conf", NULL);
+    gboolean fileFound = g_key_file_load_from_file (keyfile, configFile, G_KEY_FILE_NONE, &err);
 
     if (fileFound == FALSE) {
-      theme = "angular-theme";
       logMessage(G_LOG_LEVEL_MESSAGE, "Error trying to find config for tex-greeter: %s", err->message);
-      logMessage(G_LOG_LEVEL_MESSAGE, "Falling back theme to angular-theme");
-      g_error_free (err);
+      g_clear_error (&err);
     } else {
-      //If we got the file, then try to find the theme.
-      theme = g_key_file_get_string(keyfile, "greeter", "webkit-theme", &err);
-      if (theme == NULL) {
-        theme = "angular-theme";
-        logMessage(G_LOG_LEVEL_MESSAGE, "Error attempting to get theme name with g_key_file_get_string: %s", err->message);
-        logMessage(G_LOG_LEVEL_MESSAGE, "Falling to angular-theme");
-        g_error_free (err);
-      }
+      load_config(keyfile);
+      fake_backend_load_settings(keyfile);
+      request_filter_load(keyfile);
+    }
+    g_free (configFile);
 
-      //See if we should set the proxy.
-      gchar *httpproxy = g_key_file_get_string(keyfile, "greeter", "http-proxy", &err);
-      if (httpproxy != NULL) {
-        sethttpproxy(httpproxy);
-      } else {
-        logMessage(G_LOG_LEVEL_MESSAGE, "No http-proxy in config file: %s", err->message);
-        g_error_free (err);
-      }
+    if (theme == NULL) {
+      theme = g_strdup ("angular-theme");
+      logMessage(G_LOG_LEVEL_MESSAGE, "No webkit-theme configured, falling back to angular-theme");
     }
-    logMessage(G_LOG_LEVEL_MESSAGE, "Going with theme: %s", theme);
+
+    //See if we should set the proxy.
+    if (http_proxy != NULL)
+      sethttpproxy(http_proxy);
+
+    if (benchmark_theme != NULL) {
+      /* Relative to where we were started, as CI passes it */
+      gchar *cwd = g_get_current_dir ();
+      theme_dir = g_path_is_absolute (benchmark_theme) ? g_strdup (benchmark_theme) : g_build_filename (cwd, benchmark_theme, NULL);
+      g_free (cwd);
+      backend = &fake_backend;
+      fake_backend_set_n_users (MAX (benchmark_users, 1));
+      preauthenticate = FALSE;
+      warm_standby = FALSE;
+    } else
+      theme_dir = g_build_filename (THEME_DIR, theme, NULL);
+
+    if (g_strcmp0 (backend_name, "fake") == 0)
+      backend = &fake_backend;
+    else if (backend_name != NULL && g_strcmp0 (backend_name, "lightdm") != 0)
+      logMessage(G_LOG_LEVEL_MESSAGE, "Unknown backend %s, using lightdm", backend_name);
+    logMessage(G_LOG_LEVEL_MESSAGE, "Using the %s backend", backend->name);
+    logMessage(G_LOG_LEVEL_MESSAGE, "Going with theme: %s", theme_dir);
 
 
 
@@ -1332,39 +5735,56 @@ main (int argc, char **argv)
 
     g_key_file_free(keyfile);
 
-    window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
-    screen = gtk_window_get_screen (GTK_WINDOW(window));
-    gdk_screen_get_monitor_geometry (screen, gdk_screen_get_primary_monitor(screen), &geometry);
-    gtk_window_set_default_size (GTK_WINDOW(window), geometry.width, geometry.height);
-	  gtk_window_move (GTK_WINDOW(window), geometry.x, geometry.y);
+    background_pixbuf = load_background_pixbuf ();
+
+    apply_memory_profile ();
+    preload_catalogs ();
+    auth_stats_load ();
+    last_state_load ();
+    watch_sessions ();
+    start_enumeration ();
+    apply_gtk_settings (gdk_screen_get_default ());
+    start_watchdog ();
+
+    //A benchmark renders offscreen, Xvfb is all it needs.
+    if (benchmark_theme != NULL) {
+      window = gtk_offscreen_window_new ();
+      gtk_window_set_default_size (GTK_WINDOW (window), 1280, 800);
+      screen = gtk_window_get_screen (GTK_WINDOW(window));
+    } else {
+      window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+      screen = gtk_window_get_screen (GTK_WINDOW(window));
+      update_monitors (screen);
+      g_signal_connect (G_OBJECT (screen), "monitors-changed", G_CALLBACK (monitors_changed_cb), NULL);
+    }
 
     web_view = (WebKitWebView*) webkit_web_view_new ();
+    g_object_ref_sink (web_view);
 
     //Connect web_view signals.
-    g_signal_connect (G_OBJECT (web_view), "window-object-cleared", G_CALLBACK (window_object_cleared_cb), greeter);
-    g_signal_connect (G_OBJECT (web_view), "resource-load-failed", G_CALLBACK (resource_load_failed_cb), greeter);
-    g_signal_connect (G_OBJECT (web_view), "create-web-view", G_CALLBACK (create_web_view_cb), greeter);
+    g_signal_connect (G_OBJECT (web_view), "window-object-cleared", G_CALLBACK (window_object_cleared_cb), NULL);
+    g_signal_connect (G_OBJECT (web_view), "resource-load-failed", G_CALLBACK (resource_load_failed_cb), NULL);
+    g_signal_connect (G_OBJECT (web_view), "create-web-view", G_CALLBACK (create_web_view_cb), NULL);
+    g_signal_connect (G_OBJECT (web_view), "notify::load-status", G_CALLBACK (load_status_cb), NULL);
+    if (request_filter_enabled ())
+      g_signal_connect (G_OBJECT (web_view), "resource-request-starting", G_CALLBACK (request_filter_cb), NULL);
 
     //For debugging.
-//    g_signal_connect (G_OBJECT (web_view), "resource-request-starting", G_CALLBACK (resource_request_starting_cb), greeter);
-//    g_signal_connect (G_OBJECT (web_view), "resource-response-received", G_CALLBACK (resource_response_received_cb), greeter);
-
-
-
-    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET(web_view));
-
-    //Connect greeter signals.
-    g_signal_connect (G_OBJECT (greeter), "show-prompt", G_CALLBACK (show_prompt_cb), web_view);
+//    g_signal_connect (G_OBJECT (web_view), "resource-request-starting", G_CALLBACK (resource_request_starting_cb), NULL);
+//    g_signal_connect (G_OBJECT (web_view), "resource-response-received", G_CALLBACK (resource_response_received_cb), NULL);
 
-    g_signal_connect (G_OBJECT (greeter), "show-message", G_CALLBACK (show_message_cb), web_view);
 
-    g_signal_connect (G_OBJECT (greeter), "authentication-complete", G_CALLBACK (authentication_complete_cb), web_view);
 
-    g_signal_connect (G_OBJECT (greeter), "autologin-timer-expired", G_CALLBACK (autologin_timeout_expired_cb), web_view);
+    //Put up the last rendered frame while WebKit parses the theme.
+    gdk_screen_get_monitor_geometry (screen, gdk_screen_get_primary_monitor (screen), &geometry);
+    if (benchmark_theme == NULL)
+        show_splash (&geometry);
+    if (splash_image == NULL)
+        gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET(web_view));
 
     //Full path to index.html
-    gchar* indexHtml = g_strdup_printf("file://%s/%s/index.html", THEME_DIR, theme);
-    gchar* htmlFileName = g_strdup_printf("%s/%s/index.html", THEME_DIR, theme);
+    gchar* indexHtml = g_strdup_printf("file://%s/index.html", theme_dir);
+    gchar* htmlFileName = g_strdup_printf("%s/index.html", theme_dir);
 
 
 
@@ -1372,17 +5792,14 @@ main (int argc, char **argv)
 
     GMappedFile * mfile = g_mapped_file_new(htmlFileName, FALSE, &err);
     if (mfile == NULL) {
-      logMessage(G_LOG_LEVEL_MESSAGE, "fuck. Did not load");
+      logMessage(G_LOG_LEVEL_MESSAGE, "fuck. Did not load: %s", err->message);
+      g_clear_error (&err);
     }
 
 
 
 
-    WebKitWebSettings *settings = webkit_web_settings_new ();
-    g_object_set(G_OBJECT(settings), "enable-universal-access-from-file-uris", TRUE, NULL);
-    g_object_set(G_OBJECT(settings),"enable-file-access-from-file-uris", TRUE, NULL);
-
-    g_object_set (G_OBJECT(settings), "enable-xss-auditor", FALSE, NULL);
+    WebKitWebSettings *settings = create_web_settings ();
     webkit_web_view_set_settings (WEBKIT_WEB_VIEW(web_view), settings);
 
 
@@ -1391,13 +5808,35 @@ main (int argc, char **argv)
     gtk_widget_show_all (window);
 
 
-    gboolean connect = lightdm_greeter_connect_sync (greeter, &err);
+    //Ask to be kept between logins, older liblightdm cannot.
+    if (warm_standby && !backend->set_resettable (TRUE)) {
+      logMessage(G_LOG_LEVEL_MESSAGE, "The %s backend cannot keep the greeter between logins, warm-standby ignored", backend->name);
+      warm_standby = FALSE;
+    }
+
+    //Connect the backend, themes get prompts, messages and single user changes.
+    gboolean connect = backend->connect (&backend_events, &err);
     if (err != NULL) {
-      logMessage(G_LOG_LEVEL_MESSAGE, "Error on lightdm_greeter_connect_sync: %s", err->message);
+      logMessage(G_LOG_LEVEL_MESSAGE, "Error connecting to the %s backend: %s", backend->name, err->message);
       g_error_free (err);
     }
 
+    //Avatars for the user grid, packed on a worker.
+    if (connect && avatar_atlas_size > 0)
+        start_avatar_atlas (NULL);
+
+    //Get PAM going for the most likely user while the theme loads.
+    if (connect)
+        start_preauthentication ();
+
+    if (benchmark_theme != NULL)
+        g_timeout_add_seconds (MAX (benchmark_timeout, 1), benchmark_timeout_cb, NULL);
+
     gtk_main ();
+    auth_stats_flush ();
+
+    if (benchmark_theme != NULL)
+        return benchmark.session_started != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 
     return 0;
 }
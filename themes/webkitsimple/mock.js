@@ -38,7 +38,7 @@ if (typeof lightdm == 'undefined') {
    lightdm.can_restart = true;
    lightdm.can_shutdown = true;
 
-   lightdm.getUserProperty = function(group, prop) {
+   lightdm.getCustomProperty = function(group, prop) {
       //just a mock... not actually reading from file here!
       if (group === 'raul' && prop === 'fooinfo') {
          return 'barvalue';
@@ -54,6 +54,12 @@ if (typeof lightdm == 'undefined') {
       { name: "peterp", real_name: "Spiderman", display_name: "Peter Parker", image: "", language: "en_US", layout: null, session: null, logged_in: true}
    ];
 
+   // ?mock_users=N replaces the sample users with N synthetic ones
+   var mock_users = _lightdm_mock_get_parameter("mock_users");
+   if (mock_users !== null) {
+      lightdm.users = _lightdm_mock_generate_users(parseInt(mock_users, 10));
+   }
+
    lightdm.sessions = [
       { name: "Gnome", key: "gnome" },
       { name: "LXQt Desktop", key: "lxqt" },
@@ -63,6 +69,8 @@ if (typeof lightdm == 'undefined') {
    lightdm.num_users = lightdm.users.length;
    lightdm.timed_login_delay = 0; //set to a number higher than 0 for timed login simulation
    lightdm.timed_login_user = lightdm.timed_login_delay > 0 ? lightdm.users[0] : null;
+   lightdm.last_state = { user: null, session: null, language: null, sessions: {} };
+   lightdm.avatar_atlas = null;
 
    lightdm.get_string_property = function () {
    };
@@ -70,6 +78,20 @@ if (typeof lightdm == 'undefined') {
    };
    lightdm.get_boolean_property = function () {
    };
+   lightdm.get_user_details = function () {
+      var details = {};
+      lightdm.users.forEach(function (user) {
+         details[user.name] = { real_name: user.real_name, email: null, icon: user.image, language: null,
+                                session: null, account_type: "standard", login_time: null, locked: false };
+      });
+      if (typeof Promise === "function") {
+         return Promise.resolve(details);
+      }
+      if (typeof user_details_ready === "function") {
+         setTimeout(function () { user_details_ready(details); }, 0);
+      }
+      return null;
+   };
    lightdm.cancel_timed_login = function () {
       _lightdm_mock_check_argument_length(arguments, 0);
       lightdm._timed_login_cancelled = true;
@@ -146,6 +168,13 @@ if (typeof lightdm == 'undefined') {
       document.location.reload(true);
    };
 
+   // ?frame_budget=1 scrolls the user grid top to bottom and reports frame times
+   if (_lightdm_mock_get_parameter("frame_budget") !== null) {
+      window.addEventListener("load", function () {
+         setTimeout(_lightdm_mock_measure_frame_budget, 500);
+      });
+   }
+
    if (lightdm.timed_login_delay > 0) {
       setTimeout(function () {
          if (!lightdm._timed_login_cancelled()) timed_login();
@@ -169,3 +198,61 @@ function _lightdm_mock_get_user(username) {
    }
    return user;
 }
+
+function _lightdm_mock_get_parameter(name) {
+   var match = new RegExp("[?&]" + name + "=([^&]*)").exec(window.location.search);
+   return match ? decodeURIComponent(match[1]) : null;
+}
+
+function _lightdm_mock_generate_users(count) {
+   var users = [];
+   for (var i = 0; i < count; ++i) {
+      users.push({ name: "user" + i, real_name: "Test User " + i, display_name: "User " + i, image: "", language: "en_US", layout: null, session: null, logged_in: (i % 7) === 0 });
+   }
+   return users;
+}
+
+// Scrolls the grid by half a page per frame and records the interval between
+// frames. A dropped frame shows up as a doubled interval, so the run passes
+// while the 95th percentile stays under one and a half 60 Hz periods.
+// Results go to the console and the page title.
+function _lightdm_mock_measure_frame_budget() {
+   var BUDGET_MS = 1000 / 60;
+   var grid_node = document.querySelector("#user_grid");
+   var raf = window.requestAnimationFrame || window.webkitRequestAnimationFrame;
+   var times = [];
+   var last = null;
+
+   function step(now) {
+      if (last !== null) {
+         times.push(now - last);
+      }
+      last = now;
+
+      if (grid_node.scrollTop + grid_node.clientHeight < grid_node.scrollHeight) {
+         grid_node.scrollTop += Math.max(1, grid_node.clientHeight / 2);
+         raf(step);
+         return;
+      }
+
+      times.sort(function (a, b) { return a - b; });
+      var total = 0;
+      for (var i = 0; i < times.length; ++i) {
+         total += times[i];
+      }
+      var result = {
+         users: lightdm.users.length,
+         frames: times.length,
+         average_ms: times.length ? total / times.length : 0,
+         p95_ms: times.length ? times[Math.floor(times.length * 0.95)] : 0,
+         max_ms: times.length ? times[times.length - 1] : 0,
+         dom_tiles: document.querySelectorAll(".user").length,
+         budget_ms: BUDGET_MS
+      };
+      result.within_budget = result.p95_ms <= BUDGET_MS * 1.5;
+      console.log("frame budget: " + JSON.stringify(result));
+      document.title = (result.within_budget ? "PASS " : "FAIL ") + JSON.stringify(result);
+   }
+
+   raf(step);
+}
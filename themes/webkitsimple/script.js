@@ -1,4 +1,42 @@
 var selected_user = null;
+var user_template = null;
+
+// Tiles are laid out at fixed positions so the grid never has to measure
+// them. Keep in sync with .user in style.css.
+var TILE_WIDTH = 150;
+var TILE_HEIGHT = 150;
+// Rows rendered above and below the viewport to hide tile recycling.
+var OVERSCAN_ROWS = 2;
+// Keep in sync with .user_image in style.css.
+var AVATAR_SIZE = 80;
+// Shown where the atlas paints the avatar as background.
+var BLANK_IMAGE = "data:image/gif;base64,R0lGODlhAQABAIAAAAAAAP///yH5BAEAAAAALAAAAAABAAEAAAIBRAA7";
+
+// Every avatar packed into one image by the greeter, null without one.
+var avatar_atlas = null;
+
+// Virtualized user grid: only tiles for visible rows exist in the DOM.
+var grid = {
+   node: null,
+   content: null,
+   users: [],
+   index: {},
+   tiles: {},
+   pool: [],
+   columns: 1,
+   offset: 0,
+   height: 0,
+   scroll_top: 0,
+   // The user who logged in last, highlighted in the grid.
+   preselected: null,
+   frame_pending: false
+};
+
+var request_frame = window.requestAnimationFrame || window.webkitRequestAnimationFrame || function (callback) {
+   return setTimeout(function () {
+      callback(Date.now());
+   }, 16);
+};
 
 ///////////////////////////////////////////////
 // CALLBACK API. Called by the webkit greeeter
@@ -10,22 +48,7 @@ function show_prompt(text) {
    var password_entry = document.querySelector("#password_entry");
 
    if (!isVisible(password_container)) {
-      var users = document.querySelectorAll(".user");
-      var user_node = document.querySelector("#" + selected_user);
-      var rect = user_node.getClientRects()[0];
-      var parentRect = user_node.parentElement.getClientRects()[0];
-      var center = parentRect.width / 2;
-      var left = center - rect.width / 2 - rect.left;
-      var i;
-      if (left < 5 && left > -5) {
-         left = 0;
-      }
-      for (i = 0; i < users.length; i++) {
-         var node = users[i];
-         setVisible(node, node.id === selected_user);
-         node.style.left = left;
-      }
-
+      show_selected_user(selected_user);
       setVisible(password_container, true);
       password_entry.placeholder = text.replace(":", "");
    }
@@ -55,13 +78,55 @@ function show_error(text) {
 // called when the greeter is finished the authentication request
 function authentication_complete() {
    if (lightdm.is_authenticated) {
-      lightdm.login(lightdm.authentication_user, lightdm.default_session);
+      lightdm.login(lightdm.authentication_user, last_session(lightdm.authentication_user));
    } else {
       show_error("Authentication Failed");
       start_authentication(selected_user);
    }
 }
 
+// called when a user account appears
+function user_added(user) {
+   if (grid.index.hasOwnProperty(user.name)) {
+      return;
+   }
+   grid.index[user.name] = grid.users.length;
+   grid.users.push(user);
+   schedule_grid_render();
+}
+
+// called when a user changes, e.g. logs in or out
+function user_changed(user) {
+   if (!grid.index.hasOwnProperty(user.name)) {
+      return;
+   }
+   grid.users[grid.index[user.name]] = user;
+   if (grid.tiles.hasOwnProperty(user.name)) {
+      update_user_node(grid.tiles[user.name], user);
+   }
+}
+
+// called when the greeter has packed the avatars into a new atlas
+function avatar_atlas_changed(atlas) {
+   var name;
+   avatar_atlas = atlas;
+   for (name in grid.tiles) {
+      if (grid.tiles.hasOwnProperty(name)) {
+         update_user_node(grid.tiles[name], grid.users[grid.index[name]]);
+      }
+   }
+}
+
+// called when a user account goes away
+function user_removed(user) {
+   if (!grid.index.hasOwnProperty(user.name) || user.name === selected_user) {
+      return;
+   }
+   grid.users.splice(grid.index[user.name], 1);
+   rebuild_grid_index();
+   schedule_grid_render();
+}
+
 // called when the greeter wants us to perform a timed login
 function timed_login() {
    lightdm.login(lightdm.timed_login_user);
@@ -84,25 +149,40 @@ function provide_secret() {
    lightdm.provide_secret(entry.value);
 }
 
-function show_users() {
-   var users = document.querySelectorAll(".user");
-   var i;
-   for (i = 0; i < users.length; i++) {
-      setVisible(users[i], true);
-      users[i].style.left = 0;
+// session the user picked last time, from the greeter's saved state
+function last_session(username) {
+   var state = lightdm.last_state;
+   if (state && state.sessions.hasOwnProperty(username)) {
+      return state.sessions[username];
    }
+   return lightdm.default_session;
+}
+
+function show_users() {
+   setVisible(document.querySelector("#selected_user"), false);
+   setVisible(grid.node, true);
    setVisible(document.querySelector("#password_container"), false);
    selected_user = null;
 }
 
+function show_selected_user(username) {
+   var node = document.querySelector("#selected_user");
+   var user = grid.users[grid.index[username]];
+   if (user) {
+      update_user_node(node, user);
+   }
+   setVisible(grid.node, false);
+   setVisible(node, true);
+}
+
 function user_clicked(event) {
    if (selected_user !== null) {
       selected_user = null;
       lightdm.cancel_authentication();
       show_users();
    } else {
-      selected_user = event.currentTarget.id;
-      start_authentication(event.currentTarget.id);
+      selected_user = event.currentTarget.user_name;
+      start_authentication(selected_user);
    }
    show_message("");
    event.stopPropagation();
@@ -121,6 +201,112 @@ function isVisible(element) {
    return !element.classList.contains("hidden");
 }
 
+function rebuild_grid_index() {
+   var i;
+   grid.index = {};
+   for (i = 0; i < grid.users.length; i++) {
+      grid.index[grid.users[i].name] = i;
+   }
+}
+
+// Reads the grid geometry in one go. Only called on start and on resize so
+// scrolling never forces a synchronous layout.
+function measure_grid() {
+   var width = grid.node.clientWidth;
+   grid.height = grid.node.clientHeight;
+   grid.columns = Math.max(1, Math.floor(width / TILE_WIDTH));
+   grid.offset = Math.floor((width - grid.columns * TILE_WIDTH) / 2);
+   grid.scroll_top = grid.node.scrollTop;
+}
+
+function schedule_grid_render() {
+   if (!grid.frame_pending) {
+      grid.frame_pending = true;
+      request_frame(render_grid);
+   }
+}
+
+function acquire_tile() {
+   if (grid.pool.length > 0) {
+      return grid.pool.pop();
+   }
+   var tile = user_template.cloneNode(true);
+   tile.removeAttribute("id");
+   tile.onclick = user_clicked;
+   grid.content.appendChild(tile);
+   return tile;
+}
+
+function release_tile(tile) {
+   tile.style.display = "none";
+   tile.user_name = null;
+   tile.grid_index = -1;
+   grid.pool.push(tile);
+}
+
+// Only writes to the DOM, every value it needs was read beforehand.
+function render_grid() {
+   var rows = Math.ceil(grid.users.length / grid.columns);
+   var first_row = Math.max(0, Math.floor(grid.scroll_top / TILE_HEIGHT) - OVERSCAN_ROWS);
+   var last_row = Math.min(rows, Math.ceil((grid.scroll_top + grid.height) / TILE_HEIGHT) + OVERSCAN_ROWS);
+   var start = first_row * grid.columns;
+   var end = Math.min(grid.users.length, last_row * grid.columns);
+   var name, i, tile, user;
+
+   grid.frame_pending = false;
+
+   for (name in grid.tiles) {
+      if (grid.tiles.hasOwnProperty(name)) {
+         i = grid.index.hasOwnProperty(name) ? grid.index[name] : -1;
+         if (i < start || i >= end) {
+            release_tile(grid.tiles[name]);
+            delete grid.tiles[name];
+         }
+      }
+   }
+
+   for (i = start; i < end; i++) {
+      user = grid.users[i];
+      tile = grid.tiles[user.name];
+      if (!tile) {
+         tile = acquire_tile();
+         tile.user_name = user.name;
+         update_user_node(tile, user);
+         tile.style.display = "";
+         grid.tiles[user.name] = tile;
+      }
+      if (user.name === grid.preselected) {
+         tile.classList.add("preselected");
+      } else {
+         tile.classList.remove("preselected");
+      }
+      if (tile.grid_index !== i) {
+         tile.grid_index = i;
+         tile.style.left = (grid.offset + (i % grid.columns) * TILE_WIDTH) + "px";
+         tile.style.top = (Math.floor(i / grid.columns) * TILE_HEIGHT) + "px";
+      }
+   }
+
+   grid.content.style.height = (rows * TILE_HEIGHT) + "px";
+}
+
+function on_grid_scroll() {
+   grid.scroll_top = grid.node.scrollTop;
+   schedule_grid_render();
+}
+
+function on_grid_resize() {
+   var name;
+   measure_grid();
+   // Column count may have changed, every tile needs a new position.
+   for (name in grid.tiles) {
+      if (grid.tiles.hasOwnProperty(name)) {
+         grid.tiles[name].grid_index = -1;
+      }
+   }
+   schedule_grid_render();
+}
+
 //////////////////////////////////
 // Initialization
 //////////////////////////////////
@@ -134,38 +320,83 @@ function on_image_error(e) {
    e.currentTarget.src = "monkeyavatar.svg";
 }
 
-function initialize_users() {
-   var template = document.querySelector("#user_template");
-   var parent = template.parentElement;
-   parent.removeChild(template);
+// users.conf entries by user name, looked up once rather than per recycled tile
+var fooinfo_cache = {};
 
-   for (i = 0; i < lightdm.users.length; i += 1) {
-      user = lightdm.users[i];
-      userNode = template.cloneNode(true);
+function user_fooinfo(username) {
+   if (!fooinfo_cache.hasOwnProperty(username)) {
+      var fooinfo = lightdm.getCustomProperty(username, 'fooinfo');
+      fooinfo_cache[username] = (fooinfo !== null) ? ' (' + fooinfo + ')' : '';
+   }
+   return fooinfo_cache[username];
+}
 
+function update_user_node(userNode, user) {
+   var fooinfo = user_fooinfo(user.name);
 
-      var fooinfo = lightdm.getUserProperty(user.name, 'fooinfo');
-      fooinfo = (fooinfo !== null) ? ' (' + fooinfo + ')' : '';
+   var image = userNode.querySelectorAll(".user_image")[0];
+   var name = userNode.querySelectorAll(".user_name")[0];
+   name.innerHTML = user.display_name + fooinfo;
 
+   var tile = avatar_atlas ? avatar_atlas.avatars[user.name] : null;
+   if (tile) {
+      var scale = AVATAR_SIZE / avatar_atlas.size;
+      image.src = BLANK_IMAGE;
+      image.onerror = null;
+      image.style.backgroundImage = "url(" + avatar_atlas.image + ")";
+      image.style.backgroundSize = (avatar_atlas.width * scale) + "px " + (avatar_atlas.height * scale) + "px";
+      image.style.backgroundPosition = (-tile.x * scale) + "px " + (-tile.y * scale) + "px";
+      return;
+   }
+   image.style.backgroundImage = "";
 
-      var image = userNode.querySelectorAll(".user_image")[0];
-      var name = userNode.querySelectorAll(".user_name")[0];
-      name.innerHTML = user.display_name + fooinfo;
+   if (user.image) {
+      image.src = user.image;
+      image.onerror = on_image_error;
+   } else {
+      image.src = "monkeyavatar.svg";
+   }
+}
 
-      if (user.image) {
-         image.src = user.image;
-         image.onerror = on_image_error;
-      } else {
-         image.src = "monkeyavatar.svg";
-      }
+function initialize_users() {
+   // the table is plain data parsed in one go, no call into the greeter per field
+   var users = lightdm.user_table || lightdm.users;
+   var i;
+   user_template = document.querySelector("#user_template");
+   user_template.parentElement.removeChild(user_template);
+   user_template.classList.remove("hidden");
 
-      userNode.id = user.name;
-      userNode.onclick = user_clicked;
-      parent.appendChild(userNode);
+   avatar_atlas = lightdm.avatar_atlas;
+   grid.node = document.querySelector("#user_grid");
+   grid.content = document.querySelector("#user_grid_content");
+   for (i = 0; i < users.length; i += 1) {
+      grid.users.push(users[i]);
    }
+   rebuild_grid_index();
+
+   document.querySelector("#selected_user").onclick = user_clicked;
+   grid.node.onscroll = on_grid_scroll;
+   window.onresize = on_grid_resize;
+   measure_grid();
+   render_grid();
+
+   preselect_user(lightdm.last_state ? lightdm.last_state.user : null);
    setTimeout(show_users, 400);
 }
 
+// Highlights the user and brings their row into view, nothing is started
+// until the tile is clicked.
+function preselect_user(username) {
+   if (!username || !grid.index.hasOwnProperty(username)) {
+      return;
+   }
+   var row = Math.floor(grid.index[username] / grid.columns);
+   grid.preselected = username;
+   grid.node.scrollTop = Math.max(0, row * TILE_HEIGHT - Math.floor((grid.height - TILE_HEIGHT) / 2));
+   grid.scroll_top = grid.node.scrollTop;
+   render_grid();
+}
+
 //function add_action(id, name, image, clickhandler, template, parent) {
 //  action_node = template.cloneNode(true);
 //  action_node.id = "action_" + id;